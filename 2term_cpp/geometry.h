@@ -1,7 +1,11 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <cmath>
-#include <typeinfo>
+#include <cfloat>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 using std::vector;
 
@@ -43,9 +47,9 @@ public:
         y = 2 * center.y - y;
     }
     void rotate(const Point& center, double angle) {
-        double xCopy = x;
-        x = (x - center.x) * cos(angle) - (y - center.y) * sin(angle) + center.x;
-        y = (xCopy - center.x) * sin(angle) + (y - center.y) * cos(angle) + center.y;
+        double c = cos(angle), s = sin(angle), xCopy = x;
+        x = (x - center.x) * c - (y - center.y) * s + center.x;
+        y = (xCopy - center.x) * s + (y - center.y) * c + center.y;
     }
     void scale(const Point& center, double coefficient) {
         x = (x - center.x) * coefficient + center.x;
@@ -62,6 +66,93 @@ public:
     }
 };
 
+// x' = a*x + b*y + c, y' = d*x + e*y + f
+struct Affine {
+    double a, b, c, d, e, f;
+    Affine() : a(1), b(0), c(0), d(0), e(1), f(0) {}
+    Affine(double a, double b, double c, double d, double e, double f) : a(a), b(b), c(c), d(d), e(e), f(f) {}
+    static Affine rotation(const Point& center, double angle) {
+        double cs = cos(angle), sn = sin(angle);
+        return Affine(cs, -sn, center.x - cs * center.x + sn * center.y,
+                      sn, cs, center.y - sn * center.x - cs * center.y);
+    }
+    static Affine scaling(const Point& center, double coefficient) {
+        return Affine(coefficient, 0, center.x * (1 - coefficient),
+                      0, coefficient, center.y * (1 - coefficient));
+    }
+    static Affine reflection(const Point& center) {
+        return scaling(center, -1);
+    }
+    static Affine reflection(const Line& axis);
+    // this one after another
+    const Affine operator * (const Affine& another) const {
+        return Affine(a * another.a + b * another.d, a * another.b + b * another.e, a * another.c + b * another.f + c,
+                      d * another.a + e * another.d, d * another.b + e * another.e, d * another.c + e * another.f + f);
+    }
+    const Point operator () (const Point& p) const {
+        return Point(a * p.x + b * p.y + c, d * p.x + e * p.y + f);
+    }
+    double determinant() const {
+        return a * e - b * d;
+    }
+};
+
+// kernels moving n points given as separate x and y arrays, in place
+typedef void (*AffineKernel)(const Affine& m, double* xs, double* ys, size_t n);
+
+void affineScalar(const Affine& m, double* xs, double* ys, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        double x = xs[i], y = ys[i];
+        xs[i] = m.a * x + m.b * y + m.c;
+        ys[i] = m.d * x + m.e * y + m.f;
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2,fma")))
+void affineAVX2(const Affine& m, double* xs, double* ys, size_t n) {
+    __m256d a = _mm256_set1_pd(m.a), b = _mm256_set1_pd(m.b), c = _mm256_set1_pd(m.c);
+    __m256d d = _mm256_set1_pd(m.d), e = _mm256_set1_pd(m.e), f = _mm256_set1_pd(m.f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i), y = _mm256_loadu_pd(ys + i);
+        _mm256_storeu_pd(xs + i, _mm256_fmadd_pd(a, x, _mm256_fmadd_pd(b, y, c)));
+        _mm256_storeu_pd(ys + i, _mm256_fmadd_pd(d, x, _mm256_fmadd_pd(e, y, f)));
+    }
+    affineScalar(m, xs + i, ys + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+void affineAVX512(const Affine& m, double* xs, double* ys, size_t n) {
+    __m512d a = _mm512_set1_pd(m.a), b = _mm512_set1_pd(m.b), c = _mm512_set1_pd(m.c);
+    __m512d d = _mm512_set1_pd(m.d), e = _mm512_set1_pd(m.e), f = _mm512_set1_pd(m.f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d x = _mm512_loadu_pd(xs + i), y = _mm512_loadu_pd(ys + i);
+        _mm512_storeu_pd(xs + i, _mm512_fmadd_pd(a, x, _mm512_fmadd_pd(b, y, c)));
+        _mm512_storeu_pd(ys + i, _mm512_fmadd_pd(d, x, _mm512_fmadd_pd(e, y, f)));
+    }
+    affineScalar(m, xs + i, ys + i, n - i);
+}
+#endif
+
+// the widest kernel the cpu has
+AffineKernel affineKernel() {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return affineAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return affineAVX2;
+#endif
+    return affineScalar;
+}
+
+void transformPoints(const Affine& m, double* xs, double* ys, size_t n) {
+    static const AffineKernel kernel = affineKernel();
+    kernel(m, xs, ys, n);
+}
+
 class Line {
 public:
     double xCoef, yCoef;
@@ -108,17 +199,20 @@ public:
         double yCoord = (-xCoef * line.shift + shift * line.xCoef) / determinant;
         return Point(xCoord, yCoord);
     }
-    void reflex(Point& point) const {
-        if (yCoef == 0) {
-            point.x = -2 * shift - point.x;
-        } else {
-            point.rotate(Point(), atan(xCoef / yCoef));
-            point.y = -2 * shift - point.y;
-            point.rotate(Point(), atan(-xCoef / yCoef));
-        }
-    }
+    void reflex(Point& point) const;
 };
 
+// p - 2 * (xCoef * p.x + yCoef * p.y + shift) / (xCoef^2 + yCoef^2) * (xCoef, yCoef)
+Affine Affine::reflection(const Line& axis) {
+    double a = axis.xCoef, b = axis.yCoef, k = 2 / (a * a + b * b);
+    return Affine(1 - k * a * a, -k * a * b, -k * a * axis.shift,
+                  -k * a * b, 1 - k * b * b, -k * b * axis.shift);
+}
+
+void Line::reflex(Point& point) const {
+    point = Affine::reflection(*this)(point);
+}
+
 double getSin(const Point& a, const Point& b, const Point& c) {
     double len1 = a.distance(b), len2 = b.distance(c);
     return ((b.x - a.x) * (c.y - b.y) - (b.y - a.y) * (c.x - b.x)) / len1 / len2;
@@ -127,9 +221,188 @@ double getCos(const Point& a, const Point& b, const Point& c) {
     double l1 = a.distance(b), l2 = b.distance(c);
     return ((b.x - a.x) * (c.x - b.x) + (b.y - a.y) * (c.y - b.y)) / l1 / l2;
 }
+// Adaptive predicates: the determinant in floating point decides when it
+// exceeds its rounding error bound, otherwise it is summed exactly as an
+// expansion, a sum of nonoverlapping doubles of growing magnitude
+
+// a + b = x + y exactly
+void twoSum(double a, double b, double& x, double& y) {
+    x = a + b;
+    double bVirtual = x - a, aVirtual = x - bVirtual;
+    y = (a - aVirtual) + (b - bVirtual);
+}
+// a * b = x + y exactly
+void twoProduct(double a, double b, double& x, double& y) {
+    x = a * b;
+    y = fma(a, b, -x);
+}
+// e + f
+vector<double> expansionSum(const vector<double>& e, const vector<double>& f) {
+    vector<double> h = e, g;
+    for (size_t i = 0; i < f.size(); ++i) {
+        double q = f[i], part;
+        g.clear();
+        for (size_t j = 0; j < h.size(); ++j) {
+            twoSum(q, h[j], q, part);
+            if (part != 0)
+                g.push_back(part);
+        }
+        g.push_back(q);
+        h.swap(g);
+    }
+    return h;
+}
+// e * b
+vector<double> expansionScale(const vector<double>& e, double b) {
+    vector<double> h;
+    double q, part, high, low;
+    twoProduct(e[0], b, q, part);
+    if (part != 0)
+        h.push_back(part);
+    for (size_t i = 1; i < e.size(); ++i) {
+        twoProduct(e[i], b, high, low);
+        twoSum(q, low, q, part);
+        if (part != 0)
+            h.push_back(part);
+        twoSum(high, q, q, part);
+        if (part != 0)
+            h.push_back(part);
+    }
+    h.push_back(q);
+    return h;
+}
+vector<double> expansionProduct(const vector<double>& e, const vector<double>& f) {
+    vector<double> h(1, 0);
+    for (size_t i = 0; i < f.size(); ++i)
+        h = expansionSum(h, expansionScale(e, f[i]));
+    return h;
+}
+vector<double> expansionDiff(double a, double b) {
+    vector<double> h(2);
+    twoSum(a, -b, h[1], h[0]);
+    return h;
+}
+int expansionSign(const vector<double>& e) {
+    for (size_t i = e.size(); i-- > 0; )
+        if (e[i] != 0)
+            return e[i] > 0 ? 1 : -1;
+    return 0;
+}
+int sign(double x) {
+    return (x > 0) - (x < 0);
+}
+
+// (b - a) x (d - c), rounded but with the exact sign: the floating value
+// when it exceeds its error bound, the largest component of the exact
+// expansion otherwise
+double crossProduct(const Point& a, const Point& b, const Point& c, const Point& d) {
+    const double bound = (3.0 + 16.0 * DBL_EPSILON / 2) * DBL_EPSILON / 2;
+    double left = (b.x - a.x) * (d.y - c.y), right = (b.y - a.y) * (d.x - c.x);
+    double det = left - right;
+    if (fabs(det) > bound * (fabs(left) + fabs(right)))
+        return det;
+    vector<double> l = expansionProduct(expansionDiff(b.x, a.x), expansionDiff(d.y, c.y));
+    vector<double> r = expansionProduct(expansionDiff(b.y, a.y), expansionDiff(d.x, c.x));
+    for (size_t i = 0; i < r.size(); ++i)
+        r[i] = -r[i];
+    vector<double> e = expansionSum(l, r);
+    for (size_t i = e.size(); i-- > 0; )
+        if (e[i] != 0)
+            return e[i];
+    return 0;
+}
+
+// 1 when abc turn counterclockwise, -1 clockwise, 0 collinear, exactly
+int orient2d(const Point& a, const Point& b, const Point& c) {
+    return sign(crossProduct(c, a, c, b));
+}
+
+// 1 when d is inside the circle through the counterclockwise abc, -1
+// outside, 0 on it, exactly
+int incircle(const Point& a, const Point& b, const Point& c, const Point& d) {
+    const double bound = (10.0 + 96.0 * DBL_EPSILON / 2) * DBL_EPSILON / 2;
+    double adx = a.x - d.x, ady = a.y - d.y, bdx = b.x - d.x, bdy = b.y - d.y, cdx = c.x - d.x, cdy = c.y - d.y;
+    double alift = adx * adx + ady * ady, blift = bdx * bdx + bdy * bdy, clift = cdx * cdx + cdy * cdy;
+    double det = alift * (bdx * cdy - cdx * bdy) + blift * (cdx * ady - adx * cdy) + clift * (adx * bdy - bdx * ady);
+    double permanent = (fabs(bdx * cdy) + fabs(cdx * bdy)) * alift + (fabs(cdx * ady) + fabs(adx * cdy)) * blift +
+                       (fabs(adx * bdy) + fabs(bdx * ady)) * clift;
+    if (fabs(det) > bound * permanent)
+        return sign(det);
+    vector<double> ex[3] = {expansionDiff(a.x, d.x), expansionDiff(b.x, d.x), expansionDiff(c.x, d.x)};
+    vector<double> ey[3] = {expansionDiff(a.y, d.y), expansionDiff(b.y, d.y), expansionDiff(c.y, d.y)};
+    vector<double> sum(1, 0);
+    for (int i = 0; i < 3; ++i) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        vector<double> lift = expansionSum(expansionProduct(ex[i], ex[i]), expansionProduct(ey[i], ey[i]));
+        vector<double> minor = expansionProduct(ey[j], ex[k]);
+        for (size_t m = 0; m < minor.size(); ++m)
+            minor[m] = -minor[m];
+        minor = expansionSum(expansionProduct(ex[j], ey[k]), minor);
+        sum = expansionSum(sum, expansionProduct(lift, minor));
+    }
+    return expansionSign(sum);
+}
+
+// positive when c is to the left of ab
+double cross(const Point& a, const Point& b, const Point& c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+// within EPS of the segment, or exactly on it with EXACT_PREDICATES
+bool onSegment(const Point& a, const Point& b, const Point& p) {
+#ifdef EXACT_PREDICATES
+    return orient2d(a, b, p) == 0 &&
+           p.x >= std::min(a.x, b.x) && p.x <= std::max(a.x, b.x) &&
+           p.y >= std::min(a.y, b.y) && p.y <= std::max(a.y, b.y);
+#else
+    return fabs(cross(a, b, p)) <= EPS * a.distance(b) &&
+           p.x >= std::min(a.x, b.x) - EPS && p.x <= std::max(a.x, b.x) + EPS &&
+           p.y >= std::min(a.y, b.y) - EPS && p.y <= std::max(a.y, b.y) + EPS;
+#endif
+}
+// whether the segments ab and cd have a common point, exactly
+bool segmentsIntersect(const Point& a, const Point& b, const Point& c, const Point& d) {
+    int abc = orient2d(a, b, c), abd = orient2d(a, b, d), cda = orient2d(c, d, a), cdb = orient2d(c, d, b);
+    if (abc * abd < 0 && cda * cdb < 0)
+        return true;
+    return (abc == 0 && onSegment(a, b, c)) || (abd == 0 && onSegment(a, b, d)) ||
+           (cda == 0 && onSegment(c, d, a)) || (cdb == 0 && onSegment(c, d, b));
+}
+// the common point of the lines through ab and cd, found from the points
+// rather than the slopes, so it stays accurate for steep lines; false,
+// leaving point as it is, when the lines are exactly parallel or the same
+bool intersection(const Point& a, const Point& b, const Point& c, const Point& d, Point& point) {
+    double turn = crossProduct(a, b, c, d);
+    if (turn == 0)
+        return false;
+    double s = cross(c, d, a);
+    point = Point(a.x + (b.x - a.x) * s / turn, a.y + (b.y - a.y) * s / turn);
+    return true;
+}
 
+// Transformations only compose into the pending matrix, in O(1); flush()
+// moves the coordinates once, and every method reading them calls it first.
+// So const calls write: flush() moves the vertices and the subclasses fill
+// their caches (the containment index, the signature, the derived values)
+// on the first read. Two threads must not call even const methods of the
+// same shape at once; lock around it or give each thread its own copy
 class Shape {
+protected:
+    mutable Affine pending;
+    mutable bool transformed = false;
+    // moves the stored coordinates by m
+    virtual void apply(const Affine& m) const = 0;
 public:
+    void transform(const Affine& m) {
+        pending = m * pending;
+        transformed = true;
+    }
+    void flush() const {
+        if (transformed) {
+            apply(pending);
+            pending = Affine();
+            transformed = false;
+        }
+    }
     virtual bool operator == (const Shape& another) const = 0;
     virtual bool operator != (const Shape& another) const = 0;
     virtual bool isCongruentTo(const Shape& another) const = 0;
@@ -137,16 +410,273 @@ public:
     virtual bool containsPoint(const Point& point) const = 0;
     virtual double perimeter() const = 0;
     virtual double area() const = 0;
-    virtual void rotate(const Point& center, double angle) = 0;
-    virtual void reflex(const Point& center) = 0;
-    virtual void reflex(const Line& axis) = 0;
-    virtual void scale(const Point& center, double coefficient) = 0;
+    // the lowest and the highest corners
+    virtual const std::pair<Point, Point> boundingBox() const = 0;
+    virtual void rotate(const Point& center, double angle) {
+        transform(Affine::rotation(center, angle));
+    }
+    virtual void reflex(const Point& center) {
+        transform(Affine::reflection(center));
+    }
+    virtual void reflex(const Line& axis) {
+        transform(Affine::reflection(axis));
+    }
+    virtual void scale(const Point& center, double coefficient) {
+        transform(Affine::scaling(center, coefficient));
+    }
     virtual ~Shape() {}
 };
 
 class Polygon : public Shape {
 protected:
-    vector<Point> vertex;
+    mutable vector<Point> vertex;
+    void apply(const Affine& m) const {
+        for (size_t i = 0; i < vertex.size(); ++i)
+            vertex[i] = m(vertex[i]);
+        indexed = false;
+        corners.clear();
+        known = 0;
+    }
+    // values derived from the vertices, kept until they change; subclasses
+    // take the bits from DERIVED on
+    enum { AREA = 1, PERIMETER = 2, DERIVED = 4 };
+    mutable unsigned known = 0;
+    mutable double areaValue = 0, perimeterValue = 0;
+    // built by the first query after a change of the vertices
+    mutable bool indexed = false, convex = false;
+    mutable Point low, high;
+    // counterclockwise vertices, when the polygon is convex and simple,
+    // so that every one is seen from the first at a growing angle
+    mutable vector<Point> fan;
+    // otherwise the edges crossing each of the horizontal bands
+    mutable vector<size_t> bandStart, bandEdges;
+    mutable double bandHeight = 0;
+    // the edge from vertex i and the angle at its end, getCos and getSin
+    struct Corner {
+        double length, cos, sin;
+    };
+    mutable vector<Corner> corners;
+    mutable double cornersPerimeter = 0;
+    const vector<Corner>& signature() const {
+        size_t n = vertex.size();
+        if (corners.size() == n)
+            return corners;
+        corners.resize(n);
+        cornersPerimeter = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const Point& a = vertex[i];
+            const Point& b = vertex[(i + 1) % n];
+            corners[i].length = a.distance(b);
+            cornersPerimeter += corners[i].length;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            const Point& a = vertex[i];
+            const Point& b = vertex[(i + 1) % n];
+            const Point& c = vertex[(i + 2) % n];
+            double cross = (b.x - a.x) * (c.y - b.y) - (b.y - a.y) * (c.x - b.x);
+            double dot = (b.x - a.x) * (c.x - b.x) + (b.y - a.y) * (c.y - b.y);
+            double lengths = corners[i].length * corners[(i + 1) % n].length;
+            corners[i].cos = dot / lengths;
+            corners[i].sin = cross / lengths;
+        }
+        return corners;
+    }
+    // the corners met going the other way round, starting from vertex n - i
+    static const Corner reversed(const vector<Corner>& forward, size_t i) {
+        size_t n = forward.size();
+        const Corner& angle = forward[(2 * n - i - 2) % n];
+        Corner c = {forward[n - 1 - i].length, angle.cos, -angle.sin};
+        return c;
+    }
+    // mirrored: every angle has to be turned the other way, none straight
+    static bool sameCorner(const Corner& x, double xScale, const Corner& y, double yScale, bool mirrored) {
+        return ifEqual(x.length / xScale, y.length / yScale) && ifEqual(x.cos, y.cos) &&
+               (mirrored ? ifEqual(x.sin, -y.sin) && !ifEqual(x.sin, 0) : ifEqual(x.sin, y.sin));
+    }
+    static long long rounded(double v) {
+        return llround(v * 1e5);
+    }
+    // a corner rounded to 1e-5, the same rounding the hashes use
+    struct Key {
+        long long length, cos, sin;
+        bool operator == (const Key& another) const {
+            return length == another.length && cos == another.cos && sin == another.sin;
+        }
+    };
+    static const Key key(const Corner& c, double scale, bool mirrored) {
+        Key k = {rounded(c.length / scale), rounded(c.cos), rounded(mirrored ? -c.sin : c.sin)};
+        return k;
+    }
+    // the corner i of another, read from its vertex 0 one way or the other
+    static const Corner corner(const vector<Corner>& b, size_t i, bool backwards) {
+        return backwards ? reversed(b, i) : b[i];
+    }
+    // whether a[j] and the corner from + j of b agree for every j
+    static bool alignedFrom(const vector<Corner>& a, double aScale, const vector<Corner>& b, double bScale,
+                            size_t from, bool backwards, bool mirrored) {
+        size_t n = a.size();
+        for (size_t j = 0; j < n; ++j)
+            if (!sameCorner(a[j], aScale, corner(b, (from + j) % n, backwards), bScale, mirrored))
+                return false;
+        return true;
+    }
+    // sorted lengths and cosines of corners matching one to one lie within
+    // EPS of each other, so this rules most pairs out in O(n log n)
+    static bool sortedClose(const vector<Corner>& a, double aScale, const vector<Corner>& b, double bScale) {
+        size_t n = a.size();
+        vector<double> al(n), bl(n), ac(n), bc(n);
+        for (size_t i = 0; i < n; ++i) {
+            al[i] = a[i].length / aScale;
+            bl[i] = b[i].length / bScale;
+            ac[i] = a[i].cos;
+            bc[i] = b[i].cos;
+        }
+        std::sort(al.begin(), al.end());
+        std::sort(bl.begin(), bl.end());
+        std::sort(ac.begin(), ac.end());
+        std::sort(bc.begin(), bc.end());
+        for (size_t i = 0; i < n; ++i)
+            if (!ifEqual(al[i], bl[i]) || !ifEqual(ac[i], bc[i]))
+                return false;
+        return true;
+    }
+    // whether the corners of another, read from one of its vertices in one of
+    // the directions, repeat these with equal or, unless congruent,
+    // proportional lengths and with the same or all mirrored angles.
+    // KMP over the rounded keys finds the candidate alignments in O(n), each
+    // confirmed within EPS. Values within EPS can still round apart, so when
+    // nothing is found and the hashes differ, every alignment is tried
+    bool matches(bool congruent, const Polygon& another) const {
+        const vector<Corner>& a = signature();
+        const vector<Corner>& b = another.signature();
+        size_t n = a.size();
+        if (n != b.size())
+            return false;
+        if (n == 0)
+            return true;
+        double aScale = congruent ? 1 : cornersPerimeter, bScale = congruent ? 1 : another.cornersPerimeter;
+        vector<Key> keys(n);
+        for (size_t i = 0; i < n; ++i)
+            keys[i] = key(a[i], aScale, false);
+        vector<size_t> border(n + 1, 0);
+        for (size_t i = 1, k = 0; i < n; ++i) {
+            while (k > 0 && !(keys[i] == keys[k]))
+                k = border[k];
+            if (keys[i] == keys[k])
+                ++k;
+            border[i + 1] = k;
+        }
+        for (int way = 0; way < 4; ++way) {
+            bool backwards = way & 1, mirrored = way & 2;
+            for (size_t i = 0, k = 0; i + 1 < 2 * n; ++i) {
+                Key c = key(corner(b, i % n, backwards), bScale, mirrored);
+                while (k > 0 && !(keys[k] == c))
+                    k = border[k];
+                if (keys[k] == c)
+                    ++k;
+                if (k == n) {
+                    if (alignedFrom(a, aScale, b, bScale, i + 1 - n, backwards, mirrored))
+                        return true;
+                    k = border[k];
+                }
+            }
+        }
+        if (hash(congruent) == another.hash(congruent) || !sortedClose(a, aScale, b, bScale))
+            return false;
+        for (int way = 0; way < 4; ++way)
+            for (size_t from = 0; from < n; ++from)
+                if (alignedFrom(a, aScale, b, bScale, from, way & 1, way & 2))
+                    return true;
+        return false;
+    }
+    static size_t mix(unsigned long long x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    // each edge with the angles at both of its ends, summed so that neither
+    // the first vertex, the direction nor mirroring matters
+    size_t hash(bool congruent) const {
+        flush();
+        const vector<Corner>& c = signature();
+        size_t n = c.size(), h = mix(n);
+        double scale = congruent ? 1 : cornersPerimeter;
+        for (size_t i = 0; i < n; ++i) {
+            size_t lo = mix(mix(rounded(c[(i + n - 1) % n].cos)) + rounded(fabs(c[(i + n - 1) % n].sin)));
+            size_t hi = mix(mix(rounded(c[i].cos)) + rounded(fabs(c[i].sin)));
+            if (lo > hi)
+                std::swap(lo, hi);
+            h += mix(mix(mix(rounded(c[i].length / scale)) + lo) + hi);
+        }
+        return h;
+    }
+    size_t band(double y) const {
+        double b = bandHeight > 0 ? (y - low.y) / bandHeight : 0;
+        return b <= 0 ? 0 : std::min(bandStart.size() - 2, size_t(b));
+    }
+    void index() const {
+        size_t n = vertex.size();
+        indexed = true;
+        bool positiveSin = false, negativeSin = false;
+        for (size_t i = 0; i < n; ++i)
+            if (orient2d(vertex[i], vertex[(i+1) % n], vertex[(i+2) % n]) > 0)
+                positiveSin = true;
+            else if (orient2d(vertex[i], vertex[(i+1) % n], vertex[(i+2) % n]) < 0)
+                negativeSin = true;
+        convex = !(positiveSin && negativeSin);
+        low = high = n ? vertex[0] : Point();
+        for (size_t i = 1; i < n; ++i) {
+            low = Point(std::min(low.x, vertex[i].x), std::min(low.y, vertex[i].y));
+            high = Point(std::max(high.x, vertex[i].x), std::max(high.y, vertex[i].y));
+        }
+        fan.clear();
+        bandStart.clear();
+        bandEdges.clear();
+        if (convex && n >= 3) {
+            fan = vertex;
+            if (negativeSin)
+                std::reverse(fan.begin(), fan.end());
+            bool simple = orient2d(fan[0], fan[1], fan[n - 1]) > 0;
+            for (size_t i = 1; simple && i + 1 < n; ++i)
+                simple = orient2d(fan[0], fan[i], fan[i + 1]) >= 0 && orient2d(fan[0], fan[1], fan[i + 1]) >= 0;
+            if (simple)
+                return;
+            fan.clear();
+        }
+        // an edge lands in about extent / bandHeight + 3 bands, so with at most
+        // 3n * height / extents bands the index keeps under 6n entries even
+        // when long edges span most of the height
+        double extents = 0;
+        for (size_t i = 0; i < n; ++i)
+            extents += fabs(vertex[(i + 1) % n].y - vertex[i].y);
+        size_t bands = std::max<size_t>(n, 1);
+        if (extents > 0)
+            bands = std::max<size_t>(1, std::min<double>(bands, 3 * n * (high.y - low.y) / extents));
+        bandHeight = (high.y - low.y) / bands;
+        bandStart.assign(bands + 1, 0);
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t i = 0; i < n; ++i) {
+                const Point& a = vertex[i];
+                const Point& b = vertex[(i + 1) % n];
+                size_t first = band(std::min(a.y, b.y) - EPS), last = band(std::max(a.y, b.y) + EPS);
+                for (size_t j = first; j <= last; ++j)
+                    if (pass == 0)
+                        ++bandStart[j + 1];
+                    else
+                        bandEdges[bandStart[j]++] = i;
+            }
+            if (pass == 0) {
+                for (size_t j = 1; j < bandStart.size(); ++j)
+                    bandStart[j] += bandStart[j - 1];
+                bandEdges.resize(bandStart.back());
+            } else {
+                // every start has been moved to the next one
+                for (size_t j = bandStart.size() - 1; j > 0; --j)
+                    bandStart[j] = bandStart[j - 1];
+                bandStart[0] = 0;
+            }
+        }
+    }
 public:
     Polygon(const vector<Point>& points) {
         vertex.resize(points.size());
@@ -167,44 +697,55 @@ public:
         return vertex.size();
     }
     vector<Point> getVertices() const {
+        flush();
         return vertex;
     }
     bool isConvex() const {
-        bool positiveSin = false, negativeSin = false;
-        size_t n = vertex.size();
-        for (size_t i = 0; i < n; ++i)
-            if (getSin(vertex[i], vertex[(i+1) % n], vertex[(i+2) % n]) > 0)
-                positiveSin = true;
-            else if (getSin(vertex[i], vertex[(i+1) % n], vertex[(i+2) % n]) < 0)
-                negativeSin = true;
-        return !(positiveSin && negativeSin);
+        flush();
+        if (!indexed)
+            index();
+        return convex;
+    }
+    const std::pair<Point, Point> boundingBox() const {
+        flush();
+        if (!indexed)
+            index();
+        return std::make_pair(low, high);
     }
     double perimeter() const {
-        double per = 0;
-        for (size_t i = 0; i < vertex.size(); ++i)
-            per += vertex[i].distance(vertex[(i+1) % vertex.size()]);
-        return per;
+        flush();
+        if (!(known & PERIMETER)) {
+            double per = 0;
+            for (size_t i = 0; i < vertex.size(); ++i)
+                per += vertex[i].distance(vertex[(i+1) % vertex.size()]);
+            perimeterValue = per;
+            known |= PERIMETER;
+        }
+        return perimeterValue;
     }
     double area() const {
-        double ar = 0;
-        for (size_t i = 0; i < vertex.size(); ++i)
-            ar += vertex[i].squareUnderSegment(vertex[(i+1) % vertex.size()]);
-        return ar >= 0 ? ar : -ar;
+        flush();
+        if (!(known & AREA)) {
+            double ar = 0;
+            for (size_t i = 0; i < vertex.size(); ++i)
+                ar += vertex[i].squareUnderSegment(vertex[(i+1) % vertex.size()]);
+            areaValue = ar >= 0 ? ar : -ar;
+            known |= AREA;
+        }
+        return areaValue;
     }
     bool operator == (const Shape& another) const {
-        Polygon anotherPol;
-        try {
-            anotherPol = dynamic_cast<const Polygon&>(another);
-        }
-        catch (std::bad_cast) {
+        flush();
+        another.flush();
+        const Polygon* anotherPol = dynamic_cast<const Polygon*>(&another);
+        if (!anotherPol)
             return false;
-        }
-        if (verticesCount() != anotherPol.verticesCount())
+        if (verticesCount() != anotherPol->verticesCount())
             return false;
         for (size_t i = 0; i < vertex.size(); ++i) {
             bool equal = true;
             for (size_t j = 0; equal && j < vertex.size(); ++j) {
-                if (vertex[j] !=  anotherPol.vertex[(i+j) % vertex.size()])
+                if (vertex[j] !=  anotherPol->vertex[(i+j) % vertex.size()])
                     equal = false;
             }
             if (equal)
@@ -213,7 +754,7 @@ public:
         for (size_t i = 0; i < vertex.size(); ++i) {
             bool equal = true;
             for (size_t j = 0; equal && j < vertex.size(); ++j) {
-                if (vertex[j] !=  anotherPol.vertex[(i-j+vertex.size()) % vertex.size()])
+                if (vertex[j] !=  anotherPol->vertex[(i-j+vertex.size()) % vertex.size()])
                     equal = false;
             }
             if (equal)
@@ -224,118 +765,137 @@ public:
     bool operator != (const Shape& another) const {
         return !(*this == another);
     }
-    bool roundPass(bool congruent, bool straight, const Polygon& another) const {
-        if (verticesCount() != another.verticesCount())
-            return false;
-        for (size_t i = 0; i < vertex.size(); ++i) {
-            int way = straight ? 1 : -1;
-            size_t n = vertex.size();
-            bool equal = true;
-            bool sameSin = false;
-            bool oppSin = false;
-            double ratio = 0;
-            for (size_t j = 0; equal && j < n; ++j) {
-                if (congruent && !ifEqual(vertex[j].distance(vertex[(j + 1) % n]),
-                                          another.vertex[(i + j*way + n) % n].distance(another.vertex[(i + (j+1) * way + n) % n])))
-                    equal = false;
-                else if (!congruent && ifEqual(ratio, 0))
-                    ratio = vertex[j].distance(vertex[(j+1) % n]) /
-                            another.vertex[(i + j*way + n) % n].distance(another.vertex[(i + (j+1) * way + n) % n]);
-                else if (!congruent && !ifEqual(vertex[j].distance(vertex[(j+1) % n]) /
-                                                another.vertex[(i + j*way + n) % n].distance(another.vertex[(i + (j+1) * way + n) % n]), ratio))
-                    equal = false;
-            }
-            for (size_t j = 0; equal && j < n; ++j) {
-                if (!ifEqual(getCos(vertex[j], vertex[(j + 1) % n], vertex[(j + 2) % n]),
-                             getCos(another.vertex[(i + j*way + n) % n], another.vertex[(i + (j+1) * way + n) % n],
-                                    another.vertex[(i + (j+2) * way + n) % n])))
-                    equal = false;
-                double sin1 = getSin(vertex[j], vertex[(j + 1) % n], vertex[(j + 2) % n]);
-                double sin2 = getSin(another.vertex[(i + j*way + n) % n], another.vertex[(i + (j+1) * way + n) % n],
-                                     another.vertex[(i + (j+2) * way + n) % n]);
-                if (ifEqual(sin1, sin2))
-                    sameSin = true;
-                else if (ifEqual(sin1, -sin2) && !ifEqual(sin1, 0))
-                    oppSin = true;
-                else
-                    equal = false;
-            }
-            if (!(sameSin && oppSin) && equal)
-                return true;
-        }
-        return false;
+    // equal for congruent polygons, up to the rounding of the lengths and
+    // the cosines to 1e-5, so that a catalogue of shapes can be hashed
+    size_t congruenceHash() const {
+        return hash(true);
+    }
+    // the same for similar polygons, with the lengths relative to the perimeter
+    size_t similarityHash() const {
+        return hash(false);
     }
     bool isCongruentTo(const Shape& another) const {
-        Polygon anotherPol;
-        try {
-            anotherPol = dynamic_cast<const Polygon&>(another);
-        }
-        catch (std::bad_cast) {
+        flush();
+        another.flush();
+        const Polygon* anotherPol = dynamic_cast<const Polygon*>(&another);
+        if (!anotherPol)
             return false;
-        }
-        return roundPass(true, true, anotherPol) || roundPass(true, false, anotherPol);
+        return matches(true, *anotherPol);
     }
     bool isSimilarTo(const Shape& another) const {
-        Polygon anotherPol;
-        try {
-            anotherPol = dynamic_cast<const Polygon&>(another);
-        }
-        catch (std::bad_cast b) {
+        flush();
+        another.flush();
+        const Polygon* anotherPol = dynamic_cast<const Polygon*>(&another);
+        if (!anotherPol)
             return false;
-        }
-        return roundPass(false, true, anotherPol) || roundPass(false, false, anotherPol);
+        return matches(false, *anotherPol);
     }
+    // points on the boundary are inside
     bool containsPoint(const Point& point) const {
-        bool oddIntersections = 0;
+        flush();
+        if (!indexed)
+            index();
+        if (point.x < low.x - EPS || point.x > high.x + EPS || point.y < low.y - EPS || point.y > high.y + EPS)
+            return false;
         size_t n = vertex.size();
-        Point righty(point.x + 1, point.y);
-        Line partitionLine(point, righty);
-        for (size_t i = 0; i < n; ++i) {
-            if (!Line(vertex[i], vertex[(i + 1) % n]).ifIntersect(partitionLine))
-                continue;
-            double xIntersection = Line(vertex[i], vertex[(i + 1) % n]).intersect(partitionLine).x;
-            if (ifEqual(xIntersection, point.x) &&
-                ((xIntersection >= vertex[i].x && xIntersection <= vertex[(i + 1) % n].x) ||
-                 (xIntersection <= vertex[i].x && xIntersection >= vertex[(i + 1) % n].x))) {
-                return true;
+        if (!fan.empty()) {
+            if (orient2d(fan[0], fan[1], point) < 0 || orient2d(fan[0], fan[n - 1], point) > 0)
+                return onSegment(fan[0], fan[1], point) || onSegment(fan[0], fan[n - 1], point);
+            // the last vertex from which the point is to the left
+            size_t l = 1, r = n - 1;
+            while (r - l > 1) {
+                size_t m = (l + r) / 2;
+                if (orient2d(fan[0], fan[m], point) >= 0)
+                    l = m;
+                else
+                    r = m;
             }
-            if (xIntersection > point.x && ((vertex[i].y >= point.y) ^ (vertex[(i + 1) % n].y >= point.y)) &&
-                ((xIntersection >= vertex[i].x && xIntersection <= vertex[(i + 1) % n].x) ||
-                 (xIntersection <= vertex[i].x && xIntersection >= vertex[(i + 1) % n].x))) {
+            return orient2d(fan[l], fan[l + 1], point) >= 0 || onSegment(fan[l], fan[l + 1], point);
+        }
+        bool oddIntersections = false;
+        size_t b = band(point.y);
+        for (size_t k = bandStart[b]; k < bandStart[b + 1]; ++k) {
+            const Point& u = vertex[bandEdges[k]];
+            const Point& v = vertex[(bandEdges[k] + 1) % n];
+            if (onSegment(u, v, point))
+                return true;
+            // the edge crosses the ray to the right of the point
+            if ((u.y > point.y) != (v.y > point.y) && orient2d(u, v, point) == (v.y > u.y ? 1 : -1))
                 oddIntersections = !oddIntersections;
-            }
         }
         return oddIntersections;
     }
 
-    void rotate(const Point& center, double angle) {
-        for (size_t i = 0; i < vertex.size(); ++i)
-            vertex[i].rotate(center, angle);
+};
+
+// vertices of many polygons in separate x and y arrays, so that one kernel
+// call moves all of them
+class VertexBuffer {
+    vector<double> xs, ys;
+    vector<size_t> starts; // polygon i has the vertices [starts[i], starts[i+1])
+public:
+    VertexBuffer() : starts(1, 0) {}
+    // the index of the polygon in the buffer
+    size_t add(const Polygon& polygon) {
+        vector<Point> points = polygon.getVertices();
+        for (size_t i = 0; i < points.size(); ++i) {
+            xs.push_back(points[i].x);
+            ys.push_back(points[i].y);
+        }
+        starts.push_back(xs.size());
+        return starts.size() - 2;
     }
-    void reflex(const Point& center) {
-        for (size_t i = 0; i < vertex.size(); ++i)
-            vertex[i].reflex(center);
+    size_t polygonsCount() const {
+        return starts.size() - 1;
     }
-    void reflex(const Line& axis) {
-        for (size_t i = 0; i < vertex.size(); ++i)
-            axis.reflex(vertex[i]);
+    size_t verticesCount() const {
+        return xs.size();
     }
-    void scale(const Point& center, double coefficient) {
-        for (size_t i = 0; i < vertex.size(); ++i)
-            vertex[i].scale(center, coefficient);
+    const double* x() const {
+        return xs.data();
+    }
+    const double* y() const {
+        return ys.data();
+    }
+    void transform(const Affine& m) {
+        transformPoints(m, xs.data(), ys.data(), xs.size());
+    }
+    void transform(size_t polygon, const Affine& m) {
+        size_t begin = starts[polygon];
+        transformPoints(m, xs.data() + begin, ys.data() + begin, starts[polygon + 1] - begin);
+    }
+    // ms[i] moves the polygon i
+    void transform(const vector<Affine>& ms) {
+        for (size_t i = 0; i < ms.size() && i < polygonsCount(); ++i)
+            transform(i, ms[i]);
+    }
+    const Polygon polygon(size_t i) const {
+        vector<Point> points;
+        for (size_t j = starts[i]; j < starts[i + 1]; ++j)
+            points.push_back(Point(xs[j], ys[j]));
+        return Polygon(points);
     }
 };
 
+// only similarities keep an ellipse one, so it has to be transformed by them
 class Ellipse : public Shape {
+    friend class ShapeStore;
 protected:
-    Point foc1, foc2;
-    double bigAxis;
+    mutable Point foc1, foc2;
+    mutable double bigAxis;
+    void apply(const Affine& m) const {
+        foc1 = m(foc1);
+        foc2 = m(foc2);
+        bigAxis *= sqrt(fabs(m.determinant()));
+    }
 public:
     Ellipse(const Point& f1, const Point& f2, const double d) : foc1(f1), foc2(f2), bigAxis(d/2) {}
     const std::pair<Point,Point> focuses() const {
+        flush();
         return std::make_pair(foc1, foc2);
     }
     const std::pair<Line, Line> directrixes() const {
+        flush();
         Point paxis1 = foc1;
         paxis1.scale(center(), bigAxis*bigAxis/foc1.distance(foc2) / foc1.distance(foc2) * 4);
         Point paxis2 = foc2;
@@ -343,72 +903,68 @@ public:
         return std::make_pair(Line(paxis1, Line(foc1, foc2)), Line(paxis2, Line(foc1, foc2)));
     }
     double eccentricity() const {
+        flush();
         return focus()/bigAxis;
     }
     double focus() const {
+        flush();
         return foc1.distance(foc2) / 2;
     }
     Point center() const {
+        flush();
         return foc1.segmentMiddle(foc2);
     }
     bool operator == (const Shape& another) const {
-        Ellipse anotherEl(Point(), Point(), 0);
-        try {
-            anotherEl = dynamic_cast<const Ellipse&>(another);
-        }
-        catch (std::bad_cast) {
+        flush();
+        another.flush();
+        const Ellipse* anotherEl = dynamic_cast<const Ellipse*>(&another);
+        if (!anotherEl)
             return false;
-        }
-        return center() == anotherEl.center() && ifEqual(bigAxis, anotherEl.bigAxis);
+        return center() == anotherEl->center() && ifEqual(bigAxis, anotherEl->bigAxis);
     }
     bool operator != (const Shape& another) const {
         return !(*this == another);
     }
     bool isCongruentTo(const Shape& another) const {
-        Ellipse anotherEl(Point(), Point(), 0);
-        try {
-            anotherEl = dynamic_cast<const Ellipse&>(another);
-        }
-        catch (std::bad_cast) {
+        flush();
+        another.flush();
+        const Ellipse* anotherEl = dynamic_cast<const Ellipse*>(&another);
+        if (!anotherEl)
             return false;
-        }
-        return ifEqual(focus(), anotherEl.focus()) && ifEqual(bigAxis, anotherEl.bigAxis);
+        return ifEqual(focus(), anotherEl->focus()) && ifEqual(bigAxis, anotherEl->bigAxis);
     }
     bool isSimilarTo(const Shape& another) const {
-        Ellipse anotherEl(Point(), Point(), 0);
-        try {
-            anotherEl = dynamic_cast<const Ellipse&>(another);
-        }
-        catch (std::bad_cast) {
+        flush();
+        another.flush();
+        const Ellipse* anotherEl = dynamic_cast<const Ellipse*>(&another);
+        if (!anotherEl)
             return false;
-        }
-        return ifEqual(focus()/bigAxis, anotherEl.focus()/anotherEl.bigAxis);
+        return ifEqual(focus()/bigAxis, anotherEl->focus()/anotherEl->bigAxis);
     }
     bool containsPoint(const Point& point) const {
+        flush();
         return point.distance(foc1) + point.distance(foc2) < 2*bigAxis + EPS;
     }
     double perimeter() const {
+        flush();
         return ellipticIntegral(bigAxis, eccentricity()*eccentricity());
     }
     double area() const {
+        flush();
         return M_PI * bigAxis * sqrt(bigAxis * bigAxis - focus() * focus());
     }
-    void rotate(const Point& center, double angle) {
-        foc1.rotate(center, angle);
-        foc2.rotate(center, angle);
-    }
-    void reflex(const Point& center) {
-        foc1.reflex(center);
-        foc2.reflex(center);
-    }
-    void reflex(const Line& axis) {
-        axis.reflex(foc1);
-        axis.reflex(foc2);
-    }
-    void scale(const Point& center, double coefficient) {
-        foc1.scale(center, coefficient);
-        foc2.scale(center, coefficient);
-        bigAxis *= coefficient;
+    const std::pair<Point, Point> boundingBox() const {
+        flush();
+        double big = bigAxis, small = sqrt(std::max(0.0, bigAxis * bigAxis - focus() * focus()));
+        double ux = 1, uy = 0;
+        if (foc1 != foc2) {
+            ux = (foc2.x - foc1.x) / foc1.distance(foc2);
+            uy = (foc2.y - foc1.y) / foc1.distance(foc2);
+        }
+        double hx = sqrt(big * big * ux * ux + small * small * uy * uy);
+        double hy = sqrt(big * big * uy * uy + small * small * ux * ux);
+        Point c = center();
+        return std::make_pair(Point(c.x - hx, c.y - hy), Point(c.x + hx, c.y + hy));
     }
 };
 
@@ -416,6 +972,7 @@ class Circle : public Ellipse {
 public:
     Circle(const Point& center, const double rad) : Ellipse(center, center, 2*rad) {}
     double radius() const {
+        flush();
         return bigAxis;
     }
 };
@@ -434,9 +991,11 @@ public:
         *this = Rectangle(v1, v2, v3, v4);
     }
     const Point center() const {
+        flush();
         return vertex[0].segmentMiddle(vertex[2]);
     }
     const std::pair<Line, Line> diagonals() const {
+        flush();
         return std::make_pair(Line(vertex[0], vertex[2]), Line(vertex[1], vertex[3]));
     }
 };
@@ -446,42 +1005,68 @@ public:
     Square(const Point& a, const Point& c) : Rectangle(a, Point((a.x + c.x + a.y - c.y)/2, (-a.x + c.x + a.y + c.y)/2),
                 c, Point((a.x + c.x - a.y + c.y)/2, (a.x - c.x + a.y + c.y)/2)) {}
     const Circle circumscribedCircle() const {
+        flush();
         return Circle(vertex[0].segmentMiddle(vertex[2]), vertex[0].distance(vertex[2])/2);
     }
     const Circle inscribedCircle() const {
+        flush();
         return Circle(vertex[0].segmentMiddle(vertex[2]), vertex[0].distance(vertex[1])/2);
     }
 };
 
 class Triangle : public Polygon {
+    enum { CIRCUMSCRIBED = DERIVED, INSCRIBED = DERIVED << 1, CENTROID = DERIVED << 2, ORTHOCENTER = DERIVED << 3 };
+    mutable Circle circumscribed, inscribed;
+    mutable Point centroidValue, orthocenterValue;
 public:
-    Triangle(const Point& v1, const Point& v2, const Point& v3) : Polygon(v1, v2, v3) {}
+    Triangle(const Point& v1, const Point& v2, const Point& v3) : Polygon(v1, v2, v3),
+        circumscribed(Point(), 0), inscribed(Point(), 0) {}
     const Circle circumscribedCircle() const {
-        Line midPerp1(vertex[0].segmentMiddle(vertex[1]), Line(vertex[0], vertex[1]));
-        Line midPerp2(vertex[0].segmentMiddle(vertex[2]), Line(vertex[0], vertex[2]));
-        Point center = midPerp1.intersect(midPerp2);
-        return Circle(center, vertex[0].distance(center));
+        flush();
+        if (!(known & CIRCUMSCRIBED)) {
+            Line midPerp1(vertex[0].segmentMiddle(vertex[1]), Line(vertex[0], vertex[1]));
+            Line midPerp2(vertex[0].segmentMiddle(vertex[2]), Line(vertex[0], vertex[2]));
+            Point center = midPerp1.intersect(midPerp2);
+            circumscribed = Circle(center, vertex[0].distance(center));
+            known |= CIRCUMSCRIBED;
+        }
+        return circumscribed;
     }
     const Circle inscribedCircle() const {
-        double tangent = (vertex[0].distance(vertex[1]) + vertex[0].distance(vertex[2])
-                          - vertex[1].distance(vertex[2])) / 2;
-        Point v1 = vertex[1], v2 = vertex[2];
-        v1.scale(vertex[0], tangent / vertex[0].distance(vertex[1]));
-        v2.scale(vertex[0], tangent / vertex[0].distance(vertex[2]));
-        Line r1(v1, Line(vertex[0], vertex[1]));
-        Line r2(v2, Line(vertex[0], vertex[2]));
-        Point center = r1.intersect(r2);
-        return Circle(center, area() / perimeter() * 2);
+        flush();
+        if (!(known & INSCRIBED)) {
+            double tangent = (vertex[0].distance(vertex[1]) + vertex[0].distance(vertex[2])
+                              - vertex[1].distance(vertex[2])) / 2;
+            Point v1 = vertex[1], v2 = vertex[2];
+            v1.scale(vertex[0], tangent / vertex[0].distance(vertex[1]));
+            v2.scale(vertex[0], tangent / vertex[0].distance(vertex[2]));
+            Line r1(v1, Line(vertex[0], vertex[1]));
+            Line r2(v2, Line(vertex[0], vertex[2]));
+            Point center = r1.intersect(r2);
+            inscribed = Circle(center, area() / perimeter() * 2);
+            known |= INSCRIBED;
+        }
+        return inscribed;
     }
     const Point centroid() const {
-        double xsum = vertex[0].x + vertex[1].x + vertex[2].x;
-        double ysum = vertex[0].y + vertex[1].y + vertex[2].y;
-        return Point(xsum/3, ysum/3);
+        flush();
+        if (!(known & CENTROID)) {
+            double xsum = vertex[0].x + vertex[1].x + vertex[2].x;
+            double ysum = vertex[0].y + vertex[1].y + vertex[2].y;
+            centroidValue = Point(xsum/3, ysum/3);
+            known |= CENTROID;
+        }
+        return centroidValue;
     }
     const Point orthocenter() const {
-        Line height1(vertex[1], Line(vertex[0], vertex[2]));
-        Line height2(vertex[2], Line(vertex[0], vertex[1]));
-        return height1.intersect(height2);
+        flush();
+        if (!(known & ORTHOCENTER)) {
+            Line height1(vertex[1], Line(vertex[0], vertex[2]));
+            Line height2(vertex[2], Line(vertex[0], vertex[1]));
+            orthocenterValue = height1.intersect(height2);
+            known |= ORTHOCENTER;
+        }
+        return orthocenterValue;
     }
     const Line EulerLine() const {
         return Line(orthocenter(), circumscribedCircle().center());
@@ -490,4 +1075,455 @@ public:
         Point center = orthocenter().segmentMiddle(circumscribedCircle().center());
         return Circle(center, circumscribedCircle().radius() / 2);
     }
+};
+
+// Uniform grid over the bounding boxes of shapes owned by the caller. The
+// grid is rebuilt whenever the number of shapes doubles; a shape moved after
+// its insertion has to be updated
+class ShapeIndex {
+    struct Entry {
+        const Shape* shape; // null once removed
+        Point low, high;
+    };
+    // shapes spanning more cells are kept aside and checked by every query
+    static const size_t BIG_CELLS = 64;
+    vector<Entry> entries;
+    vector<size_t> freeIds;
+    vector<vector<size_t> > cells;
+    vector<size_t> big;
+    Point origin;
+    double side;
+    size_t columns, rows, count, builtFor;
+
+    size_t cell(double v, double from, size_t n) const {
+        double c = floor((v - from) / side);
+        return c > 0 ? std::min(n - 1, size_t(c)) : 0;
+    }
+    size_t column(double x) const {
+        return cell(x, origin.x, columns);
+    }
+    size_t row(double y) const {
+        return cell(y, origin.y, rows);
+    }
+    bool isBig(const Entry& e) const {
+        return (column(e.high.x) - column(e.low.x) + 1) * (row(e.high.y) - row(e.low.y) + 1) > BIG_CELLS;
+    }
+    void place(size_t id) {
+        const Entry& e = entries[id];
+        if (isBig(e)) {
+            big.push_back(id);
+            return;
+        }
+        for (size_t r = row(e.low.y); r <= row(e.high.y); ++r)
+            for (size_t c = column(e.low.x); c <= column(e.high.x); ++c)
+                cells[r * columns + c].push_back(id);
+    }
+    static void erase(vector<size_t>& ids, size_t id) {
+        for (size_t i = 0; i < ids.size(); ++i)
+            if (ids[i] == id) {
+                ids[i] = ids.back();
+                ids.pop_back();
+                return;
+            }
+    }
+    void unplace(size_t id) {
+        const Entry& e = entries[id];
+        if (isBig(e)) {
+            erase(big, id);
+            return;
+        }
+        for (size_t r = row(e.low.y); r <= row(e.high.y); ++r)
+            for (size_t c = column(e.low.x); c <= column(e.high.x); ++c)
+                erase(cells[r * columns + c], id);
+    }
+    void measure(size_t id) {
+        std::pair<Point, Point> box = entries[id].shape->boundingBox();
+        // containsPoint admits points EPS away
+        entries[id].low = Point(box.first.x - EPS, box.first.y - EPS);
+        entries[id].high = Point(box.second.x + EPS, box.second.y + EPS);
+    }
+    bool covers(const Entry& e, const Point& p) const {
+        return e.shape && p.x >= e.low.x && p.x <= e.high.x && p.y >= e.low.y && p.y <= e.high.y;
+    }
+    bool overlaps(const Entry& e, const Point& low, const Point& high) const {
+        return e.shape && e.low.x <= high.x && low.x <= e.high.x && e.low.y <= high.y && low.y <= e.high.y;
+    }
+    void collect(const Point& point, const vector<size_t>& ids, vector<size_t>& result) const {
+        for (size_t i = 0; i < ids.size(); ++i)
+            if (covers(entries[ids[i]], point) && entries[ids[i]].shape->containsPoint(point))
+                result.push_back(ids[i]);
+    }
+public:
+    ShapeIndex() : count(0) {
+        build();
+    }
+    // bulk load, the ids are the positions in shapes
+    ShapeIndex(const vector<const Shape*>& shapes) : count(shapes.size()) {
+        entries.resize(shapes.size());
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            entries[i].shape = shapes[i];
+            measure(i);
+        }
+        build();
+    }
+    // lays the grid out anew for the shapes indexed now
+    void build() {
+        Point low(INFINITY, INFINITY), high(-INFINITY, -INFINITY);
+        double extent = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const Entry& e = entries[i];
+            if (!e.shape)
+                continue;
+            low = Point(std::min(low.x, e.low.x), std::min(low.y, e.low.y));
+            high = Point(std::max(high.x, e.high.x), std::max(high.y, e.high.y));
+            extent += (e.high.x - e.low.x + e.high.y - e.low.y) / 2;
+        }
+        if (!count)
+            low = high = Point();
+        origin = low;
+        double width = high.x - low.x, height = high.y - low.y;
+        // about one cell per shape, but not smaller than a shape on average
+        side = std::max(extent / std::max<size_t>(count, 1), sqrt(width * height / std::max<size_t>(count, 1)));
+        if (!(side > 0))
+            side = 1;
+        while ((width / side + 1) * (height / side + 1) > 4 * count + 4)
+            side *= 2;
+        columns = size_t(width / side) + 1;
+        rows = size_t(height / side) + 1;
+        cells.assign(columns * rows, vector<size_t>());
+        big.clear();
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (entries[i].shape)
+                place(i);
+        builtFor = count;
+    }
+    size_t size() const {
+        return count;
+    }
+    const Shape& shape(size_t id) const {
+        return *entries[id].shape;
+    }
+    size_t insert(const Shape& shape) {
+        size_t id = entries.size();
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        } else
+            entries.push_back(Entry());
+        entries[id].shape = &shape;
+        measure(id);
+        ++count;
+        if (count > 2 * builtFor + BIG_CELLS)
+            build();
+        else
+            place(id);
+        return id;
+    }
+    // ids never inserted or already removed are ignored
+    void remove(size_t id) {
+        if (id >= entries.size() || !entries[id].shape)
+            return;
+        unplace(id);
+        entries[id].shape = 0;
+        freeIds.push_back(id);
+        --count;
+    }
+    // after the shape has been moved
+    void update(size_t id) {
+        if (id >= entries.size() || !entries[id].shape)
+            return;
+        unplace(id);
+        measure(id);
+        place(id);
+    }
+    // ids of the shapes containing the point
+    vector<size_t> containing(const Point& point) const {
+        vector<size_t> result;
+        collect(point, cells[row(point.y) * columns + column(point.x)], result);
+        collect(point, big, result);
+        return result;
+    }
+    // pairs (point, shape) of every point in a shape, grouped by the cells
+    // of the points, so that each cell is scanned in one go
+    vector<std::pair<size_t, size_t> > containing(const vector<Point>& points) const {
+        vector<std::pair<size_t, size_t> > order(points.size()), result;
+        for (size_t i = 0; i < points.size(); ++i)
+            order[i] = std::make_pair(row(points[i].y) * columns + column(points[i].x), i);
+        std::sort(order.begin(), order.end());
+        vector<size_t> found;
+        for (size_t i = 0; i < order.size(); ++i) {
+            const Point& point = points[order[i].second];
+            found.clear();
+            collect(point, cells[order[i].first], found);
+            collect(point, big, found);
+            for (size_t j = 0; j < found.size(); ++j)
+                result.push_back(std::make_pair(order[i].second, found[j]));
+        }
+        return result;
+    }
+    // ids of the shapes whose bounding boxes meet the window
+    vector<size_t> intersecting(const Point& low, const Point& high) const {
+        vector<size_t> result;
+        for (size_t r = row(low.y); r <= row(high.y); ++r)
+            for (size_t c = column(low.x); c <= column(high.x); ++c) {
+                const vector<size_t>& ids = cells[r * columns + c];
+                for (size_t i = 0; i < ids.size(); ++i) {
+                    const Entry& e = entries[ids[i]];
+                    // reported only by the cell of the lowest corner of the
+                    // overlap, the other cells the shape spans skip it
+                    if (overlaps(e, low, high) && column(std::max(e.low.x, low.x)) == c && row(std::max(e.low.y, low.y)) == r)
+                        result.push_back(ids[i]);
+                }
+            }
+        for (size_t i = 0; i < big.size(); ++i)
+            if (overlaps(entries[big[i]], low, high))
+                result.push_back(big[i]);
+        return result;
+    }
+    // pairs (window, shape)
+    vector<std::pair<size_t, size_t> > intersecting(const vector<std::pair<Point, Point> >& windows) const {
+        vector<std::pair<size_t, size_t> > result;
+        for (size_t i = 0; i < windows.size(); ++i) {
+            vector<size_t> found = intersecting(windows[i].first, windows[i].second);
+            for (size_t j = 0; j < found.size(); ++j)
+                result.push_back(std::make_pair(i, found[j]));
+        }
+        return result;
+    }
+};
+
+// Shapes as plain values: polygons keep their vertices in one pool shared
+// by the store, ellipses are kept inline, and the operations visit either
+// kind without virtual calls
+class ShapeStore {
+public:
+    enum Kind { POLYGON, ELLIPSE };
+    // what a visitor is handed
+    struct PolygonRef {
+        const double* xs;
+        const double* ys;
+        size_t count;
+    };
+    struct EllipseRef {
+        Point foc1, foc2;
+        double bigAxis; // half of the axis, as in Ellipse
+    };
+    struct Area {
+        double operator () (const PolygonRef& p) const {
+            double ar = 0;
+            for (size_t i = 0, j = p.count - 1; i < p.count; j = i++)
+                ar += (p.xs[j] - p.xs[i]) * (p.ys[j] + p.ys[i]) / 2;
+            return ar >= 0 ? ar : -ar;
+        }
+        double operator () (const EllipseRef& e) const {
+            return Ellipse(e.foc1, e.foc2, 2 * e.bigAxis).area();
+        }
+    };
+    struct Perimeter {
+        double operator () (const PolygonRef& p) const {
+            double per = 0;
+            for (size_t i = 0, j = p.count - 1; i < p.count; j = i++)
+                per += sqrt((p.xs[j] - p.xs[i]) * (p.xs[j] - p.xs[i]) + (p.ys[j] - p.ys[i]) * (p.ys[j] - p.ys[i]));
+            return per;
+        }
+        double operator () (const EllipseRef& e) const {
+            return Ellipse(e.foc1, e.foc2, 2 * e.bigAxis).perimeter();
+        }
+    };
+    // points on the boundary are inside
+    struct Contains {
+        Point point;
+        bool operator () (const PolygonRef& p) const {
+            bool oddIntersections = false;
+            for (size_t i = 0, j = p.count - 1; i < p.count; j = i++) {
+                Point u(p.xs[j], p.ys[j]), v(p.xs[i], p.ys[i]);
+                if (onSegment(u, v, point))
+                    return true;
+                if ((u.y > point.y) != (v.y > point.y) && orient2d(u, v, point) == (v.y > u.y ? 1 : -1))
+                    oddIntersections = !oddIntersections;
+            }
+            return oddIntersections;
+        }
+        bool operator () (const EllipseRef& e) const {
+            return point.distance(e.foc1) + point.distance(e.foc2) < 2*e.bigAxis + EPS;
+        }
+    };
+private:
+    struct PolygonItem {
+        size_t first, count; // in the pool
+    };
+    struct EllipseItem {
+        double x1, y1, x2, y2, bigAxis;
+    };
+    struct Item {
+        Kind kind;
+        union {
+            PolygonItem polygon;
+            EllipseItem ellipse;
+        };
+        Point low, high;
+    };
+    vector<Item> items;
+    vector<double> xs, ys;
+
+    void measure(Item& item) {
+        if (item.kind == ELLIPSE) {
+            std::pair<Point, Point> box = Ellipse(Point(item.ellipse.x1, item.ellipse.y1),
+                Point(item.ellipse.x2, item.ellipse.y2), 2 * item.ellipse.bigAxis).boundingBox();
+            item.low = box.first;
+            item.high = box.second;
+            return;
+        }
+        item.low = Point(INFINITY, INFINITY);
+        item.high = Point(-INFINITY, -INFINITY);
+        for (size_t i = item.polygon.first; i < item.polygon.first + item.polygon.count; ++i) {
+            item.low = Point(std::min(item.low.x, xs[i]), std::min(item.low.y, ys[i]));
+            item.high = Point(std::max(item.high.x, xs[i]), std::max(item.high.y, ys[i]));
+        }
+    }
+    void move(Item& item, const Affine& m) {
+        if (item.kind == POLYGON)
+            transformPoints(m, xs.data() + item.polygon.first, ys.data() + item.polygon.first, item.polygon.count);
+        else {
+            Point f1 = m(Point(item.ellipse.x1, item.ellipse.y1)), f2 = m(Point(item.ellipse.x2, item.ellipse.y2));
+            item.ellipse.x1 = f1.x;
+            item.ellipse.y1 = f1.y;
+            item.ellipse.x2 = f2.x;
+            item.ellipse.y2 = f2.y;
+            item.ellipse.bigAxis *= sqrt(fabs(m.determinant()));
+        }
+    }
+public:
+    // the index of the shape in the store
+    size_t add(const Polygon& polygon) {
+        vector<Point> points = polygon.getVertices();
+        Item item;
+        item.kind = POLYGON;
+        item.polygon.first = xs.size();
+        item.polygon.count = points.size();
+        for (size_t i = 0; i < points.size(); ++i) {
+            xs.push_back(points[i].x);
+            ys.push_back(points[i].y);
+        }
+        measure(item);
+        items.push_back(item);
+        return items.size() - 1;
+    }
+    size_t add(const Ellipse& ellipse) {
+        ellipse.flush();
+        Item item;
+        item.kind = ELLIPSE;
+        EllipseItem e = {ellipse.foc1.x, ellipse.foc1.y, ellipse.foc2.x, ellipse.foc2.y, ellipse.bigAxis};
+        item.ellipse = e;
+        measure(item);
+        items.push_back(item);
+        return items.size() - 1;
+    }
+    size_t size() const {
+        return items.size();
+    }
+    Kind kind(size_t i) const {
+        return items[i].kind;
+    }
+    const std::pair<Point, Point> boundingBox(size_t i) const {
+        return std::make_pair(items[i].low, items[i].high);
+    }
+    template <class Visitor>
+    auto visit(size_t i, const Visitor& visitor) const -> decltype(visitor(PolygonRef())) {
+        const Item& item = items[i];
+        if (item.kind == POLYGON) {
+            PolygonRef p = {xs.data() + item.polygon.first, ys.data() + item.polygon.first, item.polygon.count};
+            return visitor(p);
+        }
+        EllipseRef e = {Point(item.ellipse.x1, item.ellipse.y1), Point(item.ellipse.x2, item.ellipse.y2), item.ellipse.bigAxis};
+        return visitor(e);
+    }
+    double area(size_t i) const {
+        return visit(i, Area());
+    }
+    double perimeter(size_t i) const {
+        return visit(i, Perimeter());
+    }
+    bool containsPoint(size_t i, const Point& point) const {
+        const Item& item = items[i];
+        if (point.x < item.low.x - EPS || point.x > item.high.x + EPS || point.y < item.low.y - EPS || point.y > item.high.y + EPS)
+            return false;
+        Contains contains = {point};
+        return visit(i, contains);
+    }
+    vector<double> areas() const {
+        vector<double> result(items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+            result[i] = area(i);
+        return result;
+    }
+    vector<double> perimeters() const {
+        vector<double> result(items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+            result[i] = perimeter(i);
+        return result;
+    }
+    // indices of the shapes containing the point
+    vector<size_t> containing(const Point& point) const {
+        vector<size_t> result;
+        for (size_t i = 0; i < items.size(); ++i)
+            if (containsPoint(i, point))
+                result.push_back(i);
+        return result;
+    }
+    // all the vertices go through one kernel call
+    void transform(const Affine& m) {
+        transformPoints(m, xs.data(), ys.data(), xs.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (items[i].kind == ELLIPSE)
+                move(items[i], m);
+            measure(items[i]);
+        }
+    }
+    void transform(size_t i, const Affine& m) {
+        move(items[i], m);
+        measure(items[i]);
+    }
+    // false for shapes of different kinds, otherwise as Polygon and Ellipse compare
+    bool equal(size_t i, size_t j) const {
+        const Item& a = items[i];
+        const Item& b = items[j];
+        if (a.kind != b.kind)
+            return false;
+        if (a.kind == ELLIPSE)
+            return ellipse(i) == ellipse(j);
+        size_t n = a.polygon.count;
+        if (n != b.polygon.count)
+            return false;
+        const double* ax = xs.data() + a.polygon.first;
+        const double* ay = ys.data() + a.polygon.first;
+        const double* bx = xs.data() + b.polygon.first;
+        const double* by = ys.data() + b.polygon.first;
+        for (int straight = 0; straight < 2; ++straight)
+            for (size_t from = 0; from < n; ++from) {
+                bool same = true;
+                for (size_t k = 0; same && k < n; ++k) {
+                    size_t l = straight ? (from + k) % n : (from + n - k) % n;
+                    same = Point(ax[k], ay[k]) == Point(bx[l], by[l]);
+                }
+                if (same)
+                    return true;
+            }
+        return false;
+    }
+    // empty for an ellipse
+    const Polygon polygon(size_t i) const {
+        vector<Point> points;
+        if (items[i].kind == POLYGON)
+            for (size_t j = items[i].polygon.first; j < items[i].polygon.first + items[i].polygon.count; ++j)
+                points.push_back(Point(xs[j], ys[j]));
+        return Polygon(points);
+    }
+    // a point for a polygon
+    const Ellipse ellipse(size_t i) const {
+        if (items[i].kind != ELLIPSE)
+            return Ellipse(Point(), Point(), 0);
+        const EllipseItem& e = items[i].ellipse;
+        return Ellipse(Point(e.x1, e.y1), Point(e.x2, e.y2), 2 * e.bigAxis);
+    }
 };
\ No newline at end of file
@@ -1,380 +1,1161 @@
 #include <iostream>
 #include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <cstdint>
+#include <type_traits>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
-template <typename Val>
+template <typename Val, typename Policy, bool Persistent>
 class Cartesian;
 
+// the codes are the ones of the text protocol read by main()
+enum OpType { SUM = 1, INSERT, ERASE, ASSIGN, ADD, NEXT_PERMUTATION, PREV_PERMUTATION };
+
+// an op of run(), pos of INSERT and ERASE goes to l
 template <typename Val>
-struct CNode {
-    friend class Cartesian<Val>;
-private:
-    CNode *_left, *_right;//, *_par;
-    Val _val;
-    Val _sum;
-    unsigned _prior;
+struct SequenceOp {
+    int type;
+    unsigned l, r;
+    Val x;
+};
+
+// hot part of a node, the only one split and merge walk through;
+// children are pool indices, 0 is the null node
+struct CLinks {
+    enum { REVERSED = 1, TAGGED = 2 };
+    unsigned _left, _right;
     unsigned _size;
-    bool _reversed;
-    bool _added, _assigned;
-    Val _addVal, _assignVal;
-
-    unsigned _increasing_tail; // размер наибольшего нестрого возрастающего куска в конце
-    unsigned _decreasing_tail; // размер наибольшего нестрого (ибо next и prev должны быть обратными операциями) убывающего куска в конце
-    unsigned _increasing_head; // в начале
-    unsigned _decreasing_head;
-    Val _val_leftest, _val_rightest; // крайние значения поддерева
-
-    explicit CNode(Val val) :
-            _val(val),
-            _prior(unsigned(rand())),
-            _size(1),
-            _sum(val),
-            _left(nullptr),
-            _right(nullptr),
-            //_par(nullptr),
-            _reversed(false),
-            _added(false),
-            _assigned(false),
-
-            _increasing_tail(1),
-            _decreasing_head(1),
-            _decreasing_tail(1),
-            _increasing_head(1),
-            _val_leftest(val),
-            _val_rightest(val)
-    {}
-
-
-    void reverse() {
-        _reversed = false;
-        std::swap(_left, _right);
-        if (_left)
-            _left->_reversed ^= true;
-        if (_right)
-            _right->_reversed ^= true;
-        std::swap(_increasing_head, _decreasing_tail);
-        std::swap(_decreasing_head, _increasing_tail);
-        std::swap(_val_leftest, _val_rightest);
-    }
-
-    void push() {
-        if (_reversed)
-            reverse();
-
-        if (_assigned) {
-            _assigned = false;
-            _val = _assignVal;
-            _sum = _assignVal * _size;
-            _val_leftest = _val_rightest = _assignVal;
-            if (_left) {
-                _left->_added = false;
-                _left->_assigned = true;
-                _left->_assignVal = _assignVal;
-            }
-            if (_right) {
-                _right->_added = false;
-                _right->_assigned = true;
-                _right->_assignVal = _assignVal;
-            }
-            _increasing_tail = _decreasing_head = _size;
-            _increasing_head = _decreasing_tail = _size;
-        }
-
-        if (_added) {
-            _added = false;
-            _val += _addVal;
-            _sum += _addVal * _size;
-            _val_leftest += _addVal;
-            _val_rightest += _addVal;
-            if (_left) {
-                if (_left->_added)
-                    _left->_addVal += _addVal;
-                else {
-                    _left->_added = true;
-                    _left->_addVal = _addVal;
-                }
-            }
-            if (_right) {
-                if (_right->_added)
-                    _right->_addVal += _addVal;
-                else {
-                    _right->_added = true;
-                    _right->_addVal = _addVal;
-                }
-            }
+    unsigned _prior : 30;
+    unsigned _tags : 2; // lazy tags the children still owe, the cold part is read only if there are any
+};
+
+// A policy says what a node keeps about its subtree and how range updates
+// act on it. Summary is a monoid: single() of one value and combine() of two
+// neighbouring ranges, left to right, given their lengths. Tag is a lazy update: it acts on a
+// value, on the summary of size values, and compose(older, newer) gives the
+// tag doing both; reverse() turns a summary of a range into the one of the
+// range reversed. The node derives from Tag, so an empty one costs nothing.
+
+// sums without range updates, 32 bytes a node with the links
+template <typename T>
+struct SumPolicy {
+    typedef T Value;
+    struct Summary {
+        T sum;
+    };
+    struct Tag {};
+
+    static Summary single(const T& x) {
+        Summary s = {x};
+        return s;
+    }
+    static Summary combine(const Summary& a, unsigned, const Summary& b, unsigned) {
+        Summary s = {a.sum + b.sum};
+        return s;
+    }
+    static void reverse(Summary&) {}
+    static T apply(const Tag&, const T& x) {
+        return x;
+    }
+    static Summary apply(const Tag&, const Summary& s, unsigned) {
+        return s;
+    }
+    static Tag compose(const Tag&, const Tag&) {
+        return Tag();
+    }
+};
+
+// sums, minimum and maximum with assignment and addition, enough for the
+// order statistics of Cartesian
+template <typename T>
+struct StatsPolicy {
+    typedef T Value;
+    struct Summary {
+        T sum, min, max;
+    };
+    // an assignment, or an addition if !assigned
+    struct Tag {
+        bool assigned;
+        T val;
+    };
+
+    static Summary single(const T& x) {
+        Summary s = {x, x, x};
+        return s;
+    }
+    static Summary combine(const Summary& a, unsigned, const Summary& b, unsigned) {
+        Summary s = {a.sum + b.sum, std::min(a.min, b.min), std::max(a.max, b.max)};
+        return s;
+    }
+    static void reverse(Summary&) {}
+    static T apply(const Tag& t, const T& x) {
+        return t.assigned ? t.val : x + t.val;
+    }
+    static Summary apply(const Tag& t, const Summary& s, unsigned size) {
+        if (t.assigned) {
+            Summary res = {t.val * size, t.val, t.val};
+            return res;
         }
+        Summary res = {s.sum + t.val * size, s.min + t.val, s.max + t.val};
+        return res;
+    }
+    static Tag compose(const Tag& older, const Tag& newer) {
+        if (newer.assigned)
+            return newer;
+        Tag t = {older.assigned, older.val + newer.val};
+        return t;
+    }
+    static Tag add(const T& x) {
+        Tag t = {false, x};
+        return t;
+    }
+    static Tag assign(const T& x) {
+        Tag t = {true, x};
+        return t;
     }
+};
 
+// everything the protocol of main() needs: sums, assignment and addition,
+// and the monotone runs at both ends for next and prev permutation
+template <typename T>
+struct PermutationPolicy {
+    typedef T Value;
+    struct Summary {
+        T sum;
+        T leftest, rightest; // крайние значения
+        unsigned increasing_tail; // размер наибольшего нестрого возрастающего куска в конце
+        unsigned decreasing_tail; // размер наибольшего нестрого (ибо next и prev должны быть обратными операциями) убывающего куска в конце
+        unsigned increasing_head; // в начале
+        unsigned decreasing_head;
+    };
+    // an assignment, or an addition if !assigned
+    struct Tag {
+        bool assigned;
+        T val;
+    };
 
-    void recalc() {
-        _size = (_left ? _left->_size : 0) + (_right ? _right->_size : 0) + 1;
-        if (_left) {
-            _left->push();
-            _val_leftest = _left->_val_leftest;
-        } else
-            _val_leftest = _val;
-        if (_right) {
-            _right->push();
-            _val_rightest = _right->_val_rightest;
-        } else
-            _val_rightest = _val;
-        _sum = (_left ? _left->_sum : Val()) + (_right ? _right->_sum : Val()) + _val;
+    static Summary single(const T& x) {
+        Summary s = {x, x, x, 1, 1, 1, 1};
+        return s;
+    }
+    static Summary combine(const Summary& a, unsigned asize, const Summary& b, unsigned bsize) {
+        bool up = a.rightest <= b.leftest, down = a.rightest >= b.leftest;
+        Summary s;
+        s.sum = a.sum + b.sum;
+        s.leftest = a.leftest;
+        s.rightest = b.rightest;
+        s.increasing_head = a.increasing_head + (a.increasing_head == asize && up ? b.increasing_head : 0);
+        s.decreasing_head = a.decreasing_head + (a.decreasing_head == asize && down ? b.decreasing_head : 0);
+        s.increasing_tail = b.increasing_tail + (b.increasing_tail == bsize && up ? a.increasing_tail : 0);
+        s.decreasing_tail = b.decreasing_tail + (b.decreasing_tail == bsize && down ? a.decreasing_tail : 0);
+        return s;
+    }
+    static void reverse(Summary& s) {
+        std::swap(s.increasing_head, s.decreasing_tail);
+        std::swap(s.decreasing_head, s.increasing_tail);
+        std::swap(s.leftest, s.rightest);
+    }
+    static T apply(const Tag& t, const T& x) {
+        return t.assigned ? t.val : x + t.val;
+    }
+    static Summary apply(const Tag& t, const Summary& s, unsigned size) {
+        if (!t.assigned) {
+            Summary res = s;
+            res.sum += t.val * size;
+            res.leftest += t.val;
+            res.rightest += t.val;
+            return res;
+        }
+        Summary res = {t.val * size, t.val, t.val, size, size, size, size};
+        return res;
+    }
+    // an addition on top of an assignment just changes the assigned value
+    static Tag compose(const Tag& older, const Tag& newer) {
+        if (newer.assigned)
+            return newer;
+        Tag t = {older.assigned, older.val + newer.val};
+        return t;
+    }
+    static Tag add(const T& x) {
+        Tag t = {false, x};
+        return t;
+    }
+    static Tag assign(const T& x) {
+        Tag t = {true, x};
+        return t;
+    }
+};
 
-        _increasing_head = _left ? _left->_increasing_head : 0;
-        if (!_left || (_left->_increasing_head == _left->_size
-                       && _left->_val_rightest <= _val)) {
-            _increasing_head += 1;
-            if (_right && _val <= _right->_val_leftest)
-                _increasing_head += _right->_increasing_head;
+// cold part: the value, the summary of the subtree and, as the base, the
+// tag the children still owe
+template <typename Policy>
+struct CNode : Policy::Tag {
+    template <typename, typename, bool> friend class Cartesian;
+    typedef typename Policy::Value Val;
+    typedef typename Policy::Summary Summary;
+    typedef typename Policy::Tag Tag;
+private:
+    Val _val;
+    Summary _sum;
+
+    Tag& tag() {
+        return *this;
+    }
+    const Tag& tag() const {
+        return *this;
+    }
+};
+
+// both parts of the nodes live in fixed size chunks, so indices and references
+// stay valid while the pool grows; freed nodes are chained through _left.
+// The chunk tables are reserved for all 2^32 indices at once and never move,
+// so readers on other threads may look nodes up while the writer allocates.
+// Counted pools also keep a reference count for every node
+template <typename Policy, bool Counted = false>
+class CPool {
+    static const unsigned CHUNK_BITS = 14;
+    static const unsigned CHUNK = 1u << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = size_t(1) << (32 - CHUNK_BITS);
+    std::vector<CLinks*> _links;
+    std::vector<CNode<Policy>*> _nodes;
+    std::vector<unsigned*> _refs;
+    unsigned _used, _free;
+
+    void grow() {
+        _links.push_back(new CLinks[CHUNK]);
+        _nodes.push_back(new CNode<Policy>[CHUNK]);
+        if (Counted)
+            _refs.push_back(new unsigned[CHUNK]);
+    }
+public:
+    CPool() : _used(1), _free(0) {
+        _links.reserve(MAX_CHUNKS);
+        _nodes.reserve(MAX_CHUNKS);
+        if (Counted)
+            _refs.reserve(MAX_CHUNKS);
+        grow();
+        CLinks null = {0, 0, 0, 0, 0};
+        _links[0][0] = null;
+    }
+    CPool(const CPool&) = delete;
+    CPool& operator=(const CPool&) = delete;
+    ~CPool() {
+        for (size_t i = 0; i < _links.size(); ++i) {
+            delete[] _links[i];
+            delete[] _nodes[i];
         }
+        for (size_t i = 0; i < _refs.size(); ++i)
+            delete[] _refs[i];
+    }
+
+    CLinks& links(unsigned i) {
+        return _links[i >> CHUNK_BITS][i & (CHUNK - 1)];
+    }
+    CNode<Policy>& node(unsigned i) {
+        return _nodes[i >> CHUNK_BITS][i & (CHUNK - 1)];
+    }
+    const CLinks& links(unsigned i) const {
+        return _links[i >> CHUNK_BITS][i & (CHUNK - 1)];
+    }
+    const CNode<Policy>& node(unsigned i) const {
+        return _nodes[i >> CHUNK_BITS][i & (CHUNK - 1)];
+    }
+    unsigned& refs(unsigned i) {
+        return _refs[i >> CHUNK_BITS][i & (CHUNK - 1)];
+    }
 
-        _decreasing_head = _left ? _left->_decreasing_head : 0;
-        if (!_left || (_left->_decreasing_head == _left->_size
-                       && _left->_val_rightest >= _val)) {
-            _decreasing_head += 1;
-            if (_right && _val >= _right->_val_leftest)
-                _decreasing_head += _right->_decreasing_head;
+    unsigned alloc() {
+        unsigned i = _free;
+        if (i)
+            _free = links(i)._left;
+        else {
+            if (_used == _links.size() * CHUNK)
+                grow();
+            i = _used++;
         }
+        return i;
+    }
+
+    void release(unsigned i) {
+        links(i)._left = _free;
+        _free = i;
+    }
 
-        _increasing_tail = _right ? _right->_increasing_tail : 0;
-        if (!_right || (_right->_increasing_tail == _right->_size
-                        && _val <= _right->_val_leftest)) {
-            _increasing_tail += 1;
-            if (_left && _left->_val_rightest <= _val)
-                _increasing_tail += _left->_increasing_tail;
+    // forgets every node at once, the chunks are kept for reuse
+    void clear() {
+        _used = 1;
+        _free = 0;
+    }
+};
+
+// the persistent version copies every node it is about to change that is
+// shared with a snapshot (path copying), so snapshot() is O(1) and
+// snapshots never see the writer's changes. The same way publish() hands
+// the current version to the shared readers, which read it from any number
+// of threads while the writer goes on; a replaced version is freed once no
+// reader can still be in it (epoch-based reclamation)
+template <typename Val, typename Policy = PermutationPolicy<Val>, bool Persistent = false>
+class Cartesian {
+    static_assert(std::is_same<Val, typename Policy::Value>::value, "The policy is for other values");
+public:
+    typedef SequenceOp<Val> Op;
+    typedef typename Policy::Summary Summary;
+    typedef typename Policy::Tag Tag;
+    class Snapshot;
+    class SharedReader;
+private:
+    static const size_t MAX_READERS = 64;
+
+    // epoch a shared reader entered its current read in, 0 between reads
+    struct alignas(64) ReaderSlot {
+        std::atomic<bool> taken{false};
+        std::atomic<unsigned long long> epoch{0};
+    };
+    // before C++17 new[] does not honor alignas above the default alignment,
+    // and slots sharing a cache line would bring the false sharing back
+    struct SlotsDeleter {
+        void operator () (ReaderSlot* slots) const {
+            for (size_t i = 0; i < MAX_READERS; ++i)
+                slots[i].~ReaderSlot();
+            free(slots);
         }
+    };
+    static ReaderSlot* allocateSlots() {
+        void* memory = nullptr;
+        if (posix_memalign(&memory, alignof(ReaderSlot), MAX_READERS * sizeof(ReaderSlot)) != 0)
+            throw std::bad_alloc();
+        ReaderSlot* slots = static_cast<ReaderSlot*>(memory);
+        for (size_t i = 0; i < MAX_READERS; ++i)
+            new (slots + i) ReaderSlot();
+        return slots;
+    }
+
+    typedef CNode<Policy> Node;
+    CPool<Policy, Persistent> _pool;
+    unsigned _root;
+    std::vector<unsigned> _path; // nodes visited by the last split or merge
+    std::mutex _retiredLock;
+    std::vector<unsigned> _retired; // roots of destroyed snapshots
+    std::atomic<unsigned> _published{0}; // root the shared readers read
+    std::atomic<unsigned long long> _epoch{1};
+    std::deque< std::pair<unsigned long long, unsigned> > _limbo; // replaced published roots and their epochs
+    std::unique_ptr<ReaderSlot[], SlotsDeleter> _slots{Persistent ? allocateSlots() : nullptr};
+
+    CLinks& links(unsigned n) {
+        return _pool.links(n);
+    }
+    Node& node(unsigned n) {
+        return _pool.node(n);
+    }
+    const CLinks& links(unsigned n) const {
+        return _pool.links(n);
+    }
+    const Node& node(unsigned n) const {
+        return _pool.node(n);
+    }
+
+    unsigned newNode(Val val) {
+        unsigned n = _pool.alloc();
+        CLinks l = {0, 0, 1, unsigned(rand()) >> 1, 0};
+        links(n) = l;
+        node(n)._val = val;
+        node(n)._sum = Policy::single(val);
+        if (Persistent)
+            _pool.refs(n) = 1;
+        return n;
+    }
+
+    // the version of n the writer may change: n itself if nothing else
+    // refers to it, otherwise a copy that shares its children
+    unsigned own(unsigned n) {
+        if (!Persistent || !n || _pool.refs(n) == 1)
+            return n;
+        unsigned copy = _pool.alloc();
+        links(copy) = links(n);
+        node(copy) = node(n);
+        _pool.refs(copy) = 1;
+        --_pool.refs(n);
+        if (links(copy)._left)
+            ++_pool.refs(links(copy)._left);
+        if (links(copy)._right)
+            ++_pool.refs(links(copy)._right);
+        return copy;
+    }
 
-        _decreasing_tail = _right ? _right->_decreasing_tail : 0;
-        if (!_right || (_right->_decreasing_tail == _right->_size
-                        && _val >= _right->_val_leftest)) {
-            _decreasing_tail += 1;
-            if (_left && _left->_val_rightest >= _val)
-                _decreasing_tail += _left->_decreasing_tail;
+    // gives up a reference to the subtree n, the nodes nothing refers to
+    // any more go back to the pool
+    void drop(unsigned n) {
+        _path.assign(1, n);
+        while (!_path.empty()) {
+            n = _path.back();
+            _path.pop_back();
+            if (!n || (Persistent && --_pool.refs(n)))
+                continue;
+            _path.push_back(links(n)._left);
+            _path.push_back(links(n)._right);
+            _pool.release(n);
         }
     }
 
+    // called by the snapshots from any thread, the writer drops them later
+    void retire(unsigned root) {
+        std::lock_guard<std::mutex> lock(_retiredLock);
+        _retired.push_back(root);
+    }
+
+    // tags are applied to the node itself at once and its bits only mark
+    // what the children still owe, so aggregates of any node reached from
+    // the root are up to date and recalc() never pushes
+    void applyReverse(unsigned n) {
+        CLinks &l = links(n);
+        l._tags ^= CLinks::REVERSED;
+        std::swap(l._left, l._right);
+        Policy::reverse(node(n)._sum);
+    }
+
+    void applyTag(unsigned n, const Tag& tag) {
+        CLinks &l = links(n);
+        Node &c = node(n);
+        c._val = Policy::apply(tag, c._val);
+        c._sum = Policy::apply(tag, c._sum, l._size);
+        c.tag() = l._tags & CLinks::TAGGED ? Policy::compose(c.tag(), tag) : tag;
+        l._tags |= CLinks::TAGGED;
+    }
+
+    void push(unsigned n) {
+        CLinks &l = links(n);
+        if (!l._tags)
+            return;
+        if (Persistent) {
+            l._left = own(l._left);
+            l._right = own(l._right);
+        }
+        if (l._tags & CLinks::REVERSED) {
+            if (l._left)
+                applyReverse(l._left);
+            if (l._right)
+                applyReverse(l._right);
+        }
+        if (l._tags & CLinks::TAGGED) {
+            const Tag &tag = node(n).tag();
+            if (l._left)
+                applyTag(l._left, tag);
+            if (l._right)
+                applyTag(l._right, tag);
+        }
+        l._tags = 0;
+    }
 
-/// THIS IS A NEW FUNCTION
-/// summation and permutation added
+    void recalc(unsigned n) {
+        CLinks &l = links(n);
+        Node &c = node(n);
+        unsigned lsize = links(l._left)._size, rsize = links(l._right)._size;
+        l._size = lsize + rsize + 1;
+        Summary sum = Policy::single(c._val);
+        if (l._left)
+            sum = Policy::combine(node(l._left)._sum, lsize, sum, 1);
+        if (l._right)
+            sum = Policy::combine(sum, lsize + 1, node(l._right)._sum, rsize);
+        c._sum = sum;
+    }
 
     template <typename U, class... Args>
-    static void doSthInTheMiddle(CNode*& n, unsigned l, unsigned r, U f, Args&... args) {
-        CNode *left, *mid, *right;
-        split(n, r+1, mid, right);
+    void doSthInTheMiddle(unsigned l, unsigned r, U f, Args&... args) {
+        unsigned left, mid, right;
+        split(_root, r+1, mid, right);
         split(mid, l, left, mid);
-        f(mid, args...);
+        if (mid)
+            f(mid, args...);
         mid = merge(left, mid);
-        n = merge(mid, right);
+        _root = merge(mid, right);
+    }
+
+    unsigned size(unsigned n) const {
+        return links(n)._size;
+    }
+
+    // top-down: every visited node is pushed once and hung into the slot
+    // of its result tree, then the visited path is recalculated bottom-up;
+    // the visited nodes are owned, so both results are owned at their roots
+    void split(unsigned n, unsigned pos, unsigned& lres, unsigned& rres) {
+        unsigned *lslot = &lres, *rslot = &rres;
+        _path.clear();
+        for (n = own(n); n;) {
+            push(n);
+            _path.push_back(n);
+            CLinks &l = links(n);
+            if (pos <= size(l._left)) {
+                *rslot = n;
+                rslot = &l._left;
+                n = own(l._left);
+            } else {
+                pos -= size(l._left) + 1;
+                *lslot = n;
+                lslot = &l._right;
+                n = own(l._right);
+            }
+        }
+        *lslot = *rslot = 0;
+        recalcPath();
+    }
+
+    // lres gets the values before val for increasing, after it otherwise
+    void splitKey(unsigned n, Val val, unsigned& lres, unsigned& rres, bool increasing) {
+        unsigned *lslot = &lres, *rslot = &rres;
+        _path.clear();
+        for (n = own(n); n;) {
+            push(n);
+            _path.push_back(n);
+            CLinks &l = links(n);
+            if (increasing ? val <= node(n)._val : val >= node(n)._val) {
+                *rslot = n;
+                rslot = &l._left;
+                n = own(l._left);
+            } else {
+                *lslot = n;
+                lslot = &l._right;
+                n = own(l._right);
+            }
+        }
+        *lslot = *rslot = 0;
+        recalcPath();
+    }
+
+    unsigned merge(unsigned lnode, unsigned rnode) {
+        if (!lnode || !rnode)
+            return own(lnode ? lnode : rnode);
+        unsigned res;
+        unsigned *slot = &res;
+        _path.clear();
+        while (lnode && rnode) {
+            if (links(lnode)._prior < links(rnode)._prior) {
+                lnode = own(lnode);
+                push(lnode);
+                _path.push_back(lnode);
+                *slot = lnode;
+                slot = &links(lnode)._right;
+                lnode = *slot;
+            } else {
+                rnode = own(rnode);
+                push(rnode);
+                _path.push_back(rnode);
+                *slot = rnode;
+                slot = &links(rnode)._left;
+                rnode = *slot;
+            }
+        }
+        *slot = lnode ? lnode : rnode;
+        recalcPath();
+        return res;
     }
 
-    static unsigned size(CNode* n) {
-        return n ? n->_size : 0;
+    void recalcPath() {
+        for (size_t i = _path.size(); i-- > 0;)
+            recalc(_path[i]);
+    }
+
+    // treap over [begin, end) in O(n): the rightmost path is kept on a stack
+    // and every node gets its only recalc() when it leaves the stack
+    unsigned build(const Val* begin, const Val* end) {
+        std::vector<unsigned> path;
+        for (const Val* iter = begin; iter != end; ++iter) {
+            unsigned n = newNode(*iter), last = 0;
+            while (!path.empty() && links(path.back())._prior > links(n)._prior) {
+                last = path.back();
+                path.pop_back();
+                recalc(last);
+            }
+            links(n)._left = last;
+            if (!path.empty())
+                links(path.back())._right = n;
+            path.push_back(n);
+        }
+        unsigned root = 0;
+        for (; !path.empty(); path.pop_back()) {
+            root = path.back();
+            recalc(root);
+        }
+        return root;
     }
 
-    static void split(CNode* n, unsigned pos, CNode*& lres, CNode*& rres) {
-        if (!n) {
-            lres = nullptr;
-            rres = nullptr;
+    // cuts the subtree n, that starts at position base, at the sorted
+    // positions cuts[lo..hi) into pieces[lo..hi]
+    void splitMany(unsigned n, unsigned base, const std::vector<unsigned>& cuts,
+                   size_t lo, size_t hi, std::vector<unsigned>& pieces) {
+        n = own(n);
+        if (lo == hi || !n) {
+            std::fill(pieces.begin() + lo, pieces.begin() + hi + 1, 0);
+            pieces[lo] = n;
             return;
         }
-        n->push();
-        if (pos <= size(n->_left)) {
-            rres = n;
-            if (n->_right)
-                n->_right->push();
-            split(n->_left, pos, lres, n->_left);
-        } else {
-            lres = n;
-            if (n->_left)
-                n->_left->push();
-            split(n->_right, pos - size(n->_left) - 1, lres->_right, rres);
+        push(n);
+        CLinks &l = links(n);
+        unsigned pos = base + size(l._left);
+        size_t m = std::upper_bound(cuts.begin() + lo, cuts.begin() + hi, pos) - cuts.begin();
+        splitMany(l._left, base, cuts, lo, m, pieces);
+        l._left = pieces[m];
+        splitMany(l._right, pos + 1, cuts, m, hi, pieces);
+        l._right = pieces[m];
+        recalc(n);
+        pieces[m] = n;
+    }
+
+    // a range of a query, or a range op of run() clipped to the tree
+    struct Range {
+        unsigned l, r;
+        size_t op;
+    };
+
+    // tags of the ancestors a read-only descent went through without
+    // pushing them: the value change first, then the reversal
+    struct Fold {
+        bool reversed, tagged;
+        Tag tag;
+
+        Val val(const Val& x) const {
+            return tagged ? Policy::apply(tag, x) : x;
         }
-        if (lres) {
-            //lres->_par = nullptr;
-            lres->recalc();
+        Summary sum(const Summary& s, unsigned size) const {
+            Summary res = tagged ? Policy::apply(tag, s, size) : s;
+            if (reversed)
+                Policy::reverse(res);
+            return res;
         }
-        if (rres) {
-            //rres->_par = nullptr;
-            rres->recalc();
+    };
+
+    Fold noFold() const {
+        Fold f = {false, false, Tag()};
+        return f;
+    }
+
+    // the fold for the children of n, the tags of n are older than the ones in f
+    Fold under(const Fold& f, unsigned n) const {
+        const CLinks &l = links(n);
+        Fold res = f;
+        res.reversed ^= bool(l._tags & CLinks::REVERSED);
+        if (l._tags & CLinks::TAGGED) {
+            res.tag = f.tagged ? Policy::compose(node(n).tag(), f.tag) : node(n).tag();
+            res.tagged = true;
         }
+        return res;
     }
 
+    // children of n in the sequence order, with the fold f on top of n
+    unsigned leftOf(const Fold& f, unsigned n) const {
+        return f.reversed ? links(n)._right : links(n)._left;
+    }
+    unsigned rightOf(const Fold& f, unsigned n) const {
+        return f.reversed ? links(n)._left : links(n)._right;
+    }
 
-    static void splitKey(CNode* n, Val val, CNode*& lres, CNode*& rres, bool increasing) {
-        if (!n) {
-            lres = nullptr;
-            rres = nullptr;
-            return;
+    // acc summarizes count values so far
+    static void append(Summary& acc, unsigned& count, const Summary& s, unsigned size) {
+        acc = count ? Policy::combine(acc, count, s, size) : s;
+        count += size;
+    }
+
+    // appends to res[i] the part of the sorted disjoint ranges[lo..hi) inside
+    // the subtree n, that starts at position base, and counts its values in
+    // count[i]; every range has to meet the subtree. The tree is only read,
+    // the tags on the way are folded
+    void query(unsigned n, Fold f, unsigned base, const Range* ranges,
+               size_t lo, size_t hi, Summary* res, unsigned* count) const {
+        while (lo < hi && n) {
+            if (hi - lo == 1 && ranges[lo].l <= base && ranges[lo].r >= base + size(n) - 1) {
+                append(res[lo], count[lo], f.sum(node(n)._sum, size(n)), size(n));
+                return;
+            }
+            unsigned left = leftOf(f, n);
+            Fold child = under(f, n);
+            unsigned at = base + size(left);
+            size_t m = lo;
+            while (m < hi && ranges[m].l < at)
+                ++m;
+            if (left)
+                query(left, child, base, ranges, lo, m, res, count);
+            if (m > lo && ranges[m - 1].r >= at)
+                --m;
+            if (m < hi && ranges[m].l <= at) {
+                append(res[m], count[m], Policy::single(f.val(node(n)._val)), 1);
+                if (ranges[m].r == at)
+                    ++m;
+            }
+            base = at + 1;
+            n = rightOf(f, n);
+            f = child;
+            lo = m;
+        }
+    }
+
+    // summary of [l, r] of the subtree n, clipped to it, read-only
+    Summary query(unsigned n, unsigned l, unsigned r) const {
+        Range range = {l, std::min(r, size(n) - 1), 0};
+        Summary res = Summary();
+        unsigned count = 0;
+        if (n && range.l <= range.r)
+            query(n, noFold(), 0, &range, 0, 1, &res, &count);
+        return res;
+    }
+
+    // values of [l, r] of the subtree n, that starts at position base, below
+    // x, or not above it if inclusive; a subtree inside the range with all
+    // of its values on one side of x is counted by its summary
+    unsigned count(unsigned n, Fold f, unsigned base, unsigned l, unsigned r,
+                   const Val& x, bool inclusive) const {
+        unsigned res = 0;
+        while (n && base <= r && base + size(n) > l) {
+            if (l <= base && base + size(n) - 1 <= r) {
+                Summary s = f.sum(node(n)._sum, size(n));
+                if (inclusive ? !(x < s.max) : s.max < x)
+                    return res + size(n);
+                if (inclusive ? x < s.min : !(s.min < x))
+                    return res;
+            }
+            unsigned left = leftOf(f, n);
+            Fold child = under(f, n);
+            unsigned at = base + size(left);
+            if (l < at)
+                res += count(left, child, base, l, r, x, inclusive);
+            Val val = f.val(node(n)._val);
+            if (l <= at && at <= r && (inclusive ? !(x < val) : val < x))
+                ++res;
+            base = at + 1;
+            n = rightOf(f, n);
+            f = child;
         }
-        n->push();
-        if ((increasing && val <= n-> _val)
-            || (!increasing && val >= n->_val)) {
-            rres = n;
-            if (n->_right)
-                n->_right->push();
-            splitKey(n->_left, val, lres, n->_left, increasing);
-        } else {
-            lres = n;
-            if (n->_left)
-                n->_left->push();
-            splitKey(n->_right, val, lres->_right, rres, increasing);
-        }
-        if (lres) {
-            //lres->_par = nullptr;
-            lres->recalc();
-        }
-        if (rres) {
-            //rres->_par = nullptr;
-            rres->recalc();
-        }
-    }
-
-    static CNode* merge(CNode<Val>* lnode, CNode<Val>* rnode) {
-        if (!lnode) {
-            if (rnode)
-                rnode->push();
-            return rnode;
-        }
-        if (!rnode) {
-            lnode->push();
-            return lnode;
-        }
-        lnode->push();
-        rnode->push();
-        CNode<Val>* res;
-        if (lnode->_prior < rnode->_prior) {
-            res = lnode;
-            res->_right = merge(res->_right, rnode);
-        } else {
-            res = rnode;
-            res->_left = merge(lnode, res->_left);
-        }
-        //res->_par = nullptr;
-        res->recalc();
         return res;
     }
 
-    static void destroy(CNode* n) {
-        if (!n)
-            return;
-        destroy(n->_left);
-        destroy(n->_right);
-        delete n;
+    // looks for the first position res >= l of the subtree n, that starts at
+    // position base, where pred holds for the summary of [l, res]; acc
+    // summarizes the count values from l to the subtree. A subtree inside
+    // the range is entered only if pred turns true in it
+    template <typename Pred>
+    bool findFirst(unsigned n, Fold f, unsigned base, unsigned l, Summary& acc, unsigned& count,
+                   Pred& pred, unsigned& res) const {
+        while (n && base + size(n) > l) {
+            if (l <= base) {
+                Summary s = f.sum(node(n)._sum, size(n));
+                Summary all = count ? Policy::combine(acc, count, s, size(n)) : s;
+                if (!pred(all)) {
+                    acc = all;
+                    count += size(n);
+                    return false;
+                }
+            }
+            unsigned left = leftOf(f, n);
+            Fold child = under(f, n);
+            unsigned at = base + size(left);
+            if (l < at && findFirst(left, child, base, l, acc, count, pred, res))
+                return true;
+            if (l <= at) {
+                append(acc, count, Policy::single(f.val(node(n)._val)), 1);
+                if (pred(acc)) {
+                    res = at;
+                    return true;
+                }
+            }
+            base = at + 1;
+            n = rightOf(f, n);
+            f = child;
+        }
+        return false;
     }
-public:
-    static void inorder(CNode* n) {
-        if (!n)
-            return;
-        n->push();
-        n->recalc();
-        inorder(n->_left);
-        std::cout << n->_val << " ";
-        inorder(n->_right);
+
+    // element at pos of the subtree n, read-only
+    Val at(unsigned n, unsigned pos) const {
+        if (pos >= size(n))
+            throw std::out_of_range("While reading an element");
+        Fold f = noFold();
+        for (;;) {
+            unsigned left = leftOf(f, n);
+            if (pos == size(left))
+                return f.val(node(n)._val);
+            Fold child = under(f, n);
+            if (pos > size(left)) {
+                pos -= size(left) + 1;
+                n = rightOf(f, n);
+            } else
+                n = left;
+            f = child;
+        }
     }
-};
 
-template <typename Val>
-class Cartesian {
-    typedef CNode<Val>* NodePtr;
-    typedef CNode<Val> Node;
-    NodePtr _root;
+    // joins pieces[lo..hi] back: the root with the smallest priority goes on
+    // top, its old subtrees take its place when the two sides are joined
+    unsigned mergeMany(std::vector<unsigned>& pieces, size_t lo, size_t hi) {
+        if (lo == hi)
+            return pieces[lo];
+        size_t m = hi + 1;
+        for (size_t i = lo; i <= hi; ++i)
+            if (pieces[i] && (m > hi || links(pieces[i])._prior < links(pieces[m])._prior))
+                m = i;
+        if (m > hi)
+            return 0;
+        unsigned n = own(pieces[m]);
+        push(n);
+        CLinks &l = links(n);
+        pieces[m] = l._left;
+        unsigned left = mergeMany(pieces, lo, m);
+        pieces[m] = l._right;
+        l._right = mergeMany(pieces, m, hi);
+        l._left = left;
+        recalc(n);
+        return n;
+    }
+
+    // the whole subtree perm goes to its next or previous permutation
+    void permute(unsigned& perm, bool next) {
+        const Summary &p = node(perm)._sum;
+        size_t suffix = next ? p.decreasing_tail : p.increasing_tail;
+        if (suffix == size(perm))
+            applyReverse(perm);
+        else {
+            unsigned left, leftmid, mid, rightmid, right;
+            split(perm, size(perm) - suffix, left, mid);
+            split(left, size(left) - 1, left, leftmid);
+            splitKey(mid, node(leftmid)._val, mid, right, !next);
+            split(mid, size(mid) - 1, mid, rightmid);
+            mid = merge(mid, leftmid);
+            mid = merge(mid, right);
+            applyReverse(mid);
+            left = merge(left, rightmid);
+            perm = merge(left, mid);
+        }
+    }
+
+    static const size_t MAX_BATCH = 64;
+
+    // clips op to the tree and checks that it can join the batch: it has to
+    // be a range op over a range disjoint from the ones already there
+    bool batchable(const Op& op, Range& range, const std::vector<Range>& batch) {
+        if (op.type == INSERT || op.type == ERASE || op.type < SUM || op.type > PREV_PERMUTATION)
+            return false;
+        unsigned n = size(_root);
+        if (!n || (op.type >= NEXT_PERMUTATION && (op.l >= n || op.r >= n)))
+            return false;
+        if (range.r >= n)
+            range.r = n - 1;
+        for (size_t i = 0; i < batch.size(); ++i)
+            if (range.l <= batch[i].r && batch[i].l <= range.r)
+                return false;
+        return true;
+    }
+
+    void runOne(const Op& op, std::vector<Val>& res) {
+        switch (op.type) {
+            case SUM:
+                res.push_back(sum(op.l, op.r));
+                break;
+            case INSERT:
+                insert(op.x, op.l);
+                break;
+            case ERASE:
+                erase(op.l);
+                break;
+            case ASSIGN:
+                assign(op.l, op.r, op.x);
+                break;
+            case ADD:
+                add(op.l, op.r, op.x);
+                break;
+            case NEXT_PERMUTATION:
+                next_permutation(op.l, op.r);
+                break;
+            case PREV_PERMUTATION:
+                prev_permutation(op.l, op.r);
+                break;
+            default:
+                throw std::runtime_error("Invalid command");
+        }
+    }
+
+    // index of a position in the sorted cuts of a batch
+    static size_t cutIndex(const std::vector<unsigned>& cuts, unsigned pos) {
+        return std::lower_bound(cuts.begin(), cuts.end(), pos) - cuts.begin();
+    }
+
+    static bool byLeft(const Range& a, const Range& b) {
+        return a.l < b.l;
+    }
+
+    // the sums of a batch are all read in one descent; the updates work on
+    // the pieces cut out by splitMany(), and disjoint ranges make both
+    // independent of the order inside the batch
+    void runBatch(const std::vector<Op>& ops, std::vector<Range>& batch, std::vector<Val>& res) {
+        std::vector<unsigned> cuts;
+        std::vector<Range> sums;
+        for (size_t i = 0; i < batch.size(); ++i)
+            if (batch[i].l > batch[i].r)
+                continue;
+            else if (ops[batch[i].op].type == SUM)
+                sums.push_back(batch[i]);
+            else {
+                cuts.push_back(batch[i].l);
+                cuts.push_back(batch[i].r + 1);
+            }
+        std::sort(sums.begin(), sums.end(), byLeft);
+        std::sort(cuts.begin(), cuts.end());
+        cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+        std::vector<Summary> sum(sums.size());
+        std::vector<unsigned> count(sums.size());
+        query(_root, noFold(), 0, sums.data(), 0, sums.size(), sum.data(), count.data());
+        std::vector<unsigned> pieces(cuts.size() + 1);
+        if (!cuts.empty())
+            splitMany(_root, 0, cuts, 0, cuts.size(), pieces);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Op &op = ops[batch[i].op];
+            const Range &range = batch[i];
+            if (op.type == SUM) {
+                if (range.l > range.r)
+                    res.push_back(Val());
+                else
+                    res.push_back(sum[std::lower_bound(sums.begin(), sums.end(), range, byLeft) - sums.begin()].sum);
+                continue;
+            }
+            if (range.l > range.r)
+                continue;
+            unsigned &piece = pieces[cutIndex(cuts, range.l) + 1];
+            if (op.type == ASSIGN)
+                applyTag(piece, Policy::assign(op.x));
+            else if (op.type == ADD)
+                applyTag(piece, Policy::add(op.x));
+            else
+                permute(piece, op.type == NEXT_PERMUTATION);
+        }
+        if (!cuts.empty())
+            _root = mergeMany(pieces, 0, cuts.size());
+    }
+
+    template <typename F>
+    void forEach(unsigned n, F fn) const {
+        std::vector< std::pair<unsigned, Fold> > stack;
+        Fold f = noFold();
+        while (n || !stack.empty()) {
+            for (; n; n = leftOf(stack.back().second, n)) {
+                stack.push_back(std::make_pair(n, f));
+                f = under(f, n);
+            }
+            n = stack.back().first;
+            f = stack.back().second;
+            stack.pop_back();
+            fn(f.val(node(n)._val));
+            unsigned right = rightOf(f, n);
+            f = under(f, n);
+            n = right;
+        }
+    }
+
+    void inorder(unsigned n) const {
+        forEach(n, [](const Val& val) {
+            std::cout << val << " ";
+        });
+    }
 public:
     Cartesian() {
-        _root = nullptr;
+        _root = 0;
     }
 
-    Cartesian(Val* begin, Val* end) {
-        _root = nullptr;
-        for (auto iter = begin; iter != end; ++iter)
-            insert(*iter, unsigned(-1));
+    Cartesian(const Val* begin, const Val* end) {
+        _root = build(begin, end);
     }
 
+    Cartesian(const Cartesian&) = delete;
+    Cartesian& operator=(const Cartesian&) = delete;
+
     void insert(Val val, unsigned pos = unsigned(-1)) {
-        NodePtr newnode = new Node(val);
+        unsigned newnode = newNode(val);
         if (!_root) {
             _root = newnode;
             return;
         }
-        NodePtr tmp;
-        Node::split(_root, pos, tmp, _root);
-        tmp = Node::merge(tmp, newnode);
-        _root = Node::merge(tmp, _root);
+        unsigned tmp;
+        split(_root, pos, tmp, _root);
+        tmp = merge(tmp, newnode);
+        _root = merge(tmp, _root);
+    }
+
+    // inserts the whole range before pos in O(n + log)
+    void insert(const Val* begin, const Val* end, unsigned pos = unsigned(-1)) {
+        unsigned left;
+        split(_root, pos, left, _root);
+        left = merge(left, build(begin, end));
+        _root = merge(left, _root);
     }
 
     void erase(unsigned pos) {
-        if (pos >= Node::size(_root))
+        if (pos >= size(_root))
             throw std::out_of_range("While calling erase");
-        NodePtr left, mid, right;
-        Node::split(_root, pos, left, mid);
-        Node::split(mid, 1, mid, right);
-        delete mid;
-        _root = Node::merge(left, right);
+        unsigned left, mid, right;
+        split(_root, pos, left, mid);
+        split(mid, 1, mid, right);
+        drop(mid);
+        _root = merge(left, right);
     }
 
-    void add(unsigned l, unsigned r, Val val) {
-        if (_root) {
-            //Node::add(_root, l, r, val);
-            auto addNode = [](Node *&n, Val addVal) {
-                if (n->_added)
-                    n->_addVal += addVal;
-                else
-                    n->_addVal = addVal;
-                n->_added = true;
-            };
-            Node::doSthInTheMiddle(_root, l, r, addNode, val);
+    // drops the whole sequence, in O(1) unless the tree is persistent
+    void clear() {
+        if (Persistent)
+            drop(_root);
+        else
+            _pool.clear();
+        _root = 0;
+    }
+
+    // O(1): the current root is shared with the snapshot from now on
+    Snapshot snapshot() {
+        static_assert(Persistent, "Snapshots need a persistent tree");
+        collect();
+        if (_root)
+            ++_pool.refs(_root);
+        return Snapshot(this, _root);
+    }
+
+    // frees the nodes only the destroyed snapshots and the replaced
+    // published versions no reader is in any more still referred to
+    void collect() {
+        std::vector<unsigned> retired;
+        {
+            std::lock_guard<std::mutex> lock(_retiredLock);
+            retired.swap(_retired);
         }
+        for (size_t i = 0; i < retired.size(); ++i)
+            drop(retired[i]);
+        if (!Persistent)
+            return;
+        // a reader in epoch e may be in any version replaced in epoch e or later
+        unsigned long long safe = _epoch.load();
+        for (size_t i = 0; i < MAX_READERS; ++i) {
+            unsigned long long e = _slots[i].epoch.load();
+            if (e && e < safe)
+                safe = e;
+        }
+        for (; !_limbo.empty() && _limbo.front().first < safe; _limbo.pop_front())
+            drop(_limbo.front().second);
     }
 
-    void assign(unsigned l, unsigned r, Val val) {
-        if (_root) {
-            //Node::assign(_root, l, r, val);
-            auto assignNode = [](Node *&n, Val assignVal) {
-                n->_assigned = true;
-                n->_assignVal = assignVal;
-            };
-            Node::doSthInTheMiddle(_root, l, r, assignNode, val);
+    // the shared readers see the current version from now on
+    void publish() {
+        static_assert(Persistent, "Shared readers need a persistent tree");
+        if (_root)
+            ++_pool.refs(_root);
+        unsigned old = _published.exchange(_root);
+        _limbo.push_back(std::make_pair(_epoch.fetch_add(1), old));
+        collect();
+    }
+
+    // a reader for one thread at a time, at most MAX_READERS at once
+    SharedReader reader() {
+        static_assert(Persistent, "Shared readers need a persistent tree");
+        for (size_t i = 0; i < MAX_READERS; ++i) {
+            bool taken = false;
+            if (_slots[i].taken.compare_exchange_strong(taken, true))
+                return SharedReader(this, i);
         }
+        throw std::runtime_error("Too many shared readers");
     }
 
-    Val sum(unsigned l, unsigned r) {
-        Val res=Val();
+    unsigned size() {
+        return size(_root);
+    }
+
+    // applies the tag of the policy to [l, r]
+    void update(unsigned l, unsigned r, const Tag& tag) {
         if (_root) {
-            auto sumInNode = [](Node* n, Val& res) {
-                res = n->_sum;
+            auto tagNode = [this](unsigned n, const Tag& tag) {
+                applyTag(n, tag);
             };
-            Node::doSthInTheMiddle(_root, l, r, sumInNode, res);
+            doSthInTheMiddle(l, r, tagNode, tag);
+        }
+    }
+
+    void add(unsigned l, unsigned r, Val val) {
+        update(l, r, Policy::add(val));
+    }
+
+    void assign(unsigned l, unsigned r, Val val) {
+        update(l, r, Policy::assign(val));
+    }
+
+    // summary of [l, r], a value-initialized one for an empty range;
+    // read-only, so a persistent tree copies nothing for it
+    Summary query(unsigned l, unsigned r) const {
+        return query(_root, l, r);
+    }
+
+    Val sum(unsigned l, unsigned r) const {
+        return query(l, r).sum;
+    }
+
+    // The order statistics are read-only descents that need a policy with
+    // min and max in the summary, like StatsPolicy. Subtrees with all of
+    // their values on one side of x are skipped whole, so clustered values
+    // are fast, though the worst case visits the whole range
+
+    // values of [l, r] below x
+    unsigned countLess(unsigned l, unsigned r, const Val& x) const {
+        return count(_root, noFold(), 0, l, r, x, false);
+    }
+
+    // the k-th smallest value of [l, r] from 0, a bisection over the values
+    // with a count at every step
+    Val kth(unsigned l, unsigned r, unsigned k) const {
+        static_assert(std::is_integral<Val>::value, "The bisection needs integer values");
+        typedef typename std::make_unsigned<Val>::type Unsigned;
+        Summary s = query(l, r);
+        if (l > r || l >= size(_root) || k > std::min(r, size(_root) - 1) - l)
+            throw std::out_of_range("While calling kth");
+        Val lo = s.min, hi = s.max;
+        while (lo < hi) {
+            Val mid = lo + Val((Unsigned(hi) - Unsigned(lo)) / 2);
+            if (count(_root, noFold(), 0, l, r, mid, true) > k)
+                hi = mid;
+            else
+                lo = mid + 1;
         }
+        return lo;
+    }
+
+    // the first position p >= l where pred holds for the summary of [l, p],
+    // or size() if there is none; pred has to stay true once it is, then
+    // it is one descent for any policy
+    template <typename Pred>
+    unsigned findFirst(unsigned l, Pred pred) const {
+        Summary acc = Summary();
+        unsigned count = 0, res = size(_root);
+        findFirst(_root, noFold(), 0, l, acc, count, pred, res);
         return res;
     }
 
+    // the first position where the prefix sum reaches t, or size(); the
+    // prefix sums have to grow, so the values must not be negative
+    unsigned firstPrefixAtLeast(const Val& t) const {
+        return findFirst(0, [&t](const Summary& s) {
+            return !(s.sum < t);
+        });
+    }
+
     void permutation(unsigned l, unsigned r, bool next) {
-        if (l >= Node::size(_root) || r >= Node::size(_root))
+        if (l >= size(_root) || r >= size(_root))
             throw std::out_of_range("Out of range index while calling next_permutation");
 
-        auto permutationNode = [](Node* perm, bool next) {
-            if (!perm)
-                return;
-            perm->push();
-            size_t suffix = next ? perm->_decreasing_tail : perm->_increasing_tail;
-            if (suffix == perm->_size) {
-                perm->_reversed ^= true;
-                if (perm->_reversed)
-                    perm->reverse();
-            } else {
-                NodePtr left, leftmid, mid, rightmid, right;
-                Node::split(perm, perm->_size - suffix, left, mid);
-                Node::split(left, left->_size - 1, left, leftmid);
-                Node::splitKey(mid, leftmid->_val, mid, right, !next);
-                Node::split(mid, mid->_size - 1, mid, rightmid);
-                mid = Node::merge(mid, leftmid);
-                mid = Node::merge(mid, right);
-                mid->_reversed ^= true;
-                if (mid->_reversed)
-                    mid->reverse();
-                left = Node::merge(left, rightmid);
-                perm = Node::merge(left, mid);
-            }
+        auto permutationNode = [this](unsigned& perm, bool next) {
+            permute(perm, next);
         };
-        Node::doSthInTheMiddle(_root, l, r, permutationNode, next);
+        doSthInTheMiddle(l, r, permutationNode, next);
     }
 
 
@@ -386,70 +1167,878 @@ public:
         permutation(l, r, false);
     }
 
-    NodePtr root() const {
-        return _root;
+    void reverse(unsigned l, unsigned r) {
+        if (_root) {
+            auto reverseNode = [this](unsigned n) {
+                applyReverse(n);
+            };
+            doSthInTheMiddle(l, r, reverseNode);
+        }
+    }
+
+    // calls f for every value in order
+    template <typename F>
+    void forEach(F f) const {
+        forEach(_root, f);
+    }
+
+    void inorder() const {
+        inorder(_root);
+    }
+
+    // runs ops in order and returns the results of the sums; a run of range
+    // ops over pairwise disjoint ranges is cut out of the tree by one
+    // multi-way split, executed on the pieces and put back by one multi-way merge
+    std::vector<Val> run(const std::vector<Op>& ops) {
+        std::vector<Val> res;
+        std::vector<Range> batch;
+        for (size_t i = 0; i < ops.size();) {
+            batch.clear();
+            for (; i < ops.size() && batch.size() < MAX_BATCH; ++i) {
+                Range range = {ops[i].l, ops[i].r, i};
+                if (!batchable(ops[i], range, batch))
+                    break;
+                batch.push_back(range);
+            }
+            if (batch.size() > 1)
+                runBatch(ops, batch, res);
+            else if (batch.size() == 1)
+                runOne(ops[i - 1], res);
+            else
+                runOne(ops[i++], res);
+        }
+        return res;
+    }
+};
+
+// read-only view of a persistent tree at the moment of snapshot(): the writer
+// never changes its nodes, so it can be read from any thread while the
+// writer goes on; it has to be destroyed before the tree
+template <typename Val, typename Policy, bool Persistent>
+class Cartesian<Val, Policy, Persistent>::Snapshot {
+    Cartesian *_tree;
+    unsigned _root;
+public:
+    Snapshot(Cartesian* tree, unsigned root) : _tree(tree), _root(root) {}
+    Snapshot(Snapshot&& other) : _tree(other._tree), _root(other._root) {
+        other._tree = nullptr;
+    }
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot() {
+        if (_tree && _root)
+            _tree->retire(_root);
+    }
+
+    unsigned size() const {
+        return _tree->size(_root);
+    }
+
+    Summary query(unsigned l, unsigned r) const {
+        return _tree->query(_root, l, r);
+    }
+
+    Val sum(unsigned l, unsigned r) const {
+        return query(l, r).sum;
+    }
+
+    Val operator[](unsigned pos) const {
+        return _tree->at(_root, pos);
+    }
+
+    void inorder() const {
+        _tree->inorder(_root);
+    }
+};
+
+// reads the last published version, every call is one read-only descent
+// in its own epoch; it has to be destroyed before the tree
+template <typename Val, typename Policy, bool Persistent>
+class Cartesian<Val, Policy, Persistent>::SharedReader {
+    Cartesian *_tree;
+    size_t _slot;
+
+    // announces the epoch before taking the root, so the writer keeps
+    // every version the reader may get
+    class Read {
+        std::atomic<unsigned long long> &_epoch;
+    public:
+        unsigned root;
+
+        Read(const SharedReader& reader) : _epoch(reader._tree->_slots[reader._slot].epoch) {
+            _epoch.store(reader._tree->_epoch.load());
+            root = reader._tree->_published.load();
+        }
+        ~Read() {
+            _epoch.store(0, std::memory_order_release);
+        }
+    };
+public:
+    SharedReader(Cartesian* tree, size_t slot) : _tree(tree), _slot(slot) {}
+    SharedReader(SharedReader&& other) : _tree(other._tree), _slot(other._slot) {
+        other._tree = nullptr;
+    }
+    SharedReader(const SharedReader&) = delete;
+    SharedReader& operator=(const SharedReader&) = delete;
+    ~SharedReader() {
+        if (_tree)
+            _tree->_slots[_slot].taken.store(false, std::memory_order_release);
+    }
+
+    unsigned size() const {
+        Read read(*this);
+        return _tree->size(read.root);
     }
 
-    ~Cartesian() {
-        Node::destroy(_root);
+    Summary query(unsigned l, unsigned r) const {
+        Read read(*this);
+        return _tree->query(read.root, l, r);
+    }
+
+    Val sum(unsigned l, unsigned r) const {
+        return query(l, r).sum;
+    }
+
+    Val operator[](unsigned pos) const {
+        Read read(*this);
+        return _tree->at(read.root, pos);
     }
 };
 
-int main() {
-    Cartesian<long long> tree;
-
-    std::ios_base::sync_with_stdio(0);
-    std::cin.tie(0);
-
-    int n;
-    std::cin >> n;
-    for (int i = 0; i < n; ++i) {
-        long long x;
-        std::cin >> x;
-        tree.insert(x);
-    }
-
-    int m;
-    std::cin >> m;
-    for (int i = 0; i < m; ++i) {
-        int op;
-        std::cin >> op;
-        unsigned l, r, pos;
-        long long x;
-        switch (op) {
-            case 1:
-                std::cin >> l >> r;
-                std::cout << tree.sum(l, r) << std::endl;
+template <typename Val, typename Policy = PermutationPolicy<Val> >
+using PersistentCartesian = Cartesian<Val, Policy, true>;
+
+// kernels of the block scans; the generic ones keep four independent sums
+// so that the compiler can vectorize them, long long has AVX2 versions
+// picked at run time
+template <typename Val>
+Val blockSum(const Val* v, size_t n) {
+    Val s0 = Val(), s1 = Val(), s2 = Val(), s3 = Val();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += v[i];
+        s1 += v[i + 1];
+        s2 += v[i + 2];
+        s3 += v[i + 3];
+    }
+    for (; i < n; ++i)
+        s0 += v[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+template <typename Val>
+void blockAdd(Val* v, size_t n, Val x) {
+    for (size_t i = 0; i < n; ++i)
+        v[i] += x;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+long long blockSumAVX2(const long long* v, size_t n) {
+    __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_epi64(s0, _mm256_loadu_si256((const __m256i*)(v + i)));
+        s1 = _mm256_add_epi64(s1, _mm256_loadu_si256((const __m256i*)(v + i + 4)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(s0, s1));
+    long long s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; ++i)
+        s += v[i];
+    return s;
+}
+
+__attribute__((target("avx2")))
+void blockAddAVX2(long long* v, size_t n, long long x) {
+    __m256i add = _mm256_set1_epi64x(x);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_si256((__m256i*)(v + i), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(v + i)), add));
+    for (; i < n; ++i)
+        v[i] += x;
+}
+
+bool hasAVX2() {
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return avx2;
+}
+
+template <>
+long long blockSum(const long long* v, size_t n) {
+    if (hasAVX2())
+        return blockSumAVX2(v, n);
+    long long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += v[i];
+        s1 += v[i + 1];
+        s2 += v[i + 2];
+        s3 += v[i + 3];
+    }
+    for (; i < n; ++i)
+        s0 += v[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+template <>
+void blockAdd(long long* v, size_t n, long long x) {
+    if (hasAVX2())
+        return blockAddAVX2(v, n, x);
+    for (size_t i = 0; i < n; ++i)
+        v[i] += x;
+}
+#endif
+
+// the sequence of Cartesian with the same ops on contiguous blocks: reads
+// scan whole blocks instead of chasing nodes, so it wins on read-heavy
+// traffic. A block has the summary and the tags of PermutationPolicy; as in
+// the treap, they are applied to the summary at once and owed by the values.
+// Blocks hold up to 2 * BLOCK values and two neighbours always more than BLOCK
+template <typename Val>
+class BlockSequence {
+public:
+    typedef SequenceOp<Val> Op;
+private:
+    typedef PermutationPolicy<Val> Policy;
+    typedef typename Policy::Summary Summary;
+    typedef typename Policy::Tag Tag;
+    static const unsigned BLOCK = 2048;
+
+    struct Block {
+        std::vector<Val> vals;
+        Summary sum;
+        bool reversed, tagged;
+        Tag tag;
+    };
+    std::vector<Block> _blocks;
+    unsigned _size;
+
+    static unsigned size(const Block& b) {
+        return b.vals.size();
+    }
+
+    void push(Block& b) {
+        if (b.tagged) {
+            if (b.tag.assigned)
+                std::fill(b.vals.begin(), b.vals.end(), b.tag.val);
+            else
+                blockAdd(b.vals.data(), b.vals.size(), b.tag.val);
+        }
+        if (b.reversed)
+            std::reverse(b.vals.begin(), b.vals.end());
+        b.reversed = b.tagged = false;
+    }
+
+    // the summary of the values of a pushed block
+    void recalc(Block& b) {
+        const std::vector<Val> &v = b.vals;
+        unsigned n = v.size(), i;
+        Summary &s = b.sum;
+        s.sum = blockSum(v.data(), n);
+        s.leftest = v[0];
+        s.rightest = v[n - 1];
+        for (i = 1; i < n && v[i - 1] <= v[i]; ++i) {}
+        s.increasing_head = i;
+        for (i = 1; i < n && v[i - 1] >= v[i]; ++i) {}
+        s.decreasing_head = i;
+        for (i = 1; i < n && v[n - i - 1] <= v[n - i]; ++i) {}
+        s.increasing_tail = i;
+        for (i = 1; i < n && v[n - i - 1] >= v[n - i]; ++i) {}
+        s.decreasing_tail = i;
+    }
+
+    Block makeBlock(const Val* begin, const Val* end) {
+        Block b;
+        b.vals.assign(begin, end);
+        b.reversed = b.tagged = false;
+        recalc(b);
+        return b;
+    }
+
+    void applyTag(Block& b, const Tag& tag) {
+        b.sum = Policy::apply(tag, b.sum, size(b));
+        b.tag = b.tagged ? Policy::compose(b.tag, tag) : tag;
+        b.tagged = true;
+    }
+
+    void applyReverse(Block& b) {
+        Policy::reverse(b.sum);
+        b.reversed = !b.reversed;
+    }
+
+    // the block containing pos and the position in it
+    size_t locate(unsigned& pos) const {
+        size_t k = 0;
+        for (; k + 1 < _blocks.size() && pos >= size(_blocks[k]); ++k)
+            pos -= size(_blocks[k]);
+        return k;
+    }
+
+    // value at pos of the block, read through its tags
+    Val get(const Block& b, unsigned pos) const {
+        Val x = b.vals[b.reversed ? size(b) - 1 - pos : pos];
+        return b.tagged ? Policy::apply(b.tag, x) : x;
+    }
+
+    void set(unsigned pos, Val val) {
+        Block &b = _blocks[locate(pos)];
+        push(b);
+        b.vals[pos] = val;
+        recalc(b);
+    }
+
+    // index of the block that starts at pos, the one holding it is cut in two
+    size_t cut(unsigned pos) {
+        if (pos >= _size)
+            return _blocks.size();
+        size_t k = locate(pos);
+        if (!pos)
+            return k;
+        push(_blocks[k]);
+        const std::vector<Val> &v = _blocks[k].vals;
+        Block right = makeBlock(v.data() + pos, v.data() + v.size());
+        _blocks[k].vals.resize(pos);
+        recalc(_blocks[k]);
+        _blocks.insert(_blocks.begin() + k + 1, std::move(right));
+        return k + 1;
+    }
+
+    // merges the blocks k - 1 and k if they are small together
+    void join(size_t k) {
+        if (!k || k >= _blocks.size() || size(_blocks[k - 1]) + size(_blocks[k]) > BLOCK)
+            return;
+        Block &left = _blocks[k - 1], &right = _blocks[k];
+        push(left);
+        push(right);
+        left.vals.insert(left.vals.end(), right.vals.begin(), right.vals.end());
+        recalc(left);
+        _blocks.erase(_blocks.begin() + k);
+    }
+
+    // f gets the blocks [i, j) that make [l, r] after the cuts, and may
+    // move j if it cuts or joins blocks in between
+    template <typename F>
+    void onRange(unsigned l, unsigned r, F f) {
+        if (r >= _size)
+            r = _size - 1;
+        if (l > r || l >= _size)
+            return;
+        size_t i = cut(l);
+        size_t j = cut(r + 1);
+        f(i, j);
+        join(j);
+        join(i);
+    }
+
+    // next or previous permutation of the blocks [i, j), j follows the cuts and joins
+    void permute(size_t i, size_t& j, bool next) {
+        Summary s = _blocks[i].sum;
+        unsigned len = size(_blocks[i]);
+        for (size_t k = i + 1; k < j; ++k) {
+            s = Policy::combine(s, len, _blocks[k].sum, size(_blocks[k]));
+            len += size(_blocks[k]);
+        }
+        unsigned suffix = next ? s.decreasing_tail : s.increasing_tail;
+        size_t from = i;
+        if (suffix < len) {
+            unsigned begin = 0;
+            for (size_t k = 0; k < i; ++k)
+                begin += size(_blocks[k]);
+            unsigned pivot = begin + len - suffix - 1, pos = pivot;
+            size_t k = locate(pos);
+            Val val = get(_blocks[k], pos);
+            size_t blocks = _blocks.size();
+            from = cut(pivot + 1);
+            j += _blocks.size() - blocks;
+            // the suffix goes down for next, the last value beyond val is swapped with it
+            k = j - 1;
+            unsigned end = begin + len;
+            for (;; end -= size(_blocks[k--]))
+                if (next ? _blocks[k].sum.leftest > val : _blocks[k].sum.leftest < val)
+                    break;
+            const Block &b = _blocks[k];
+            unsigned at = size(b) - 1;
+            for (; next ? get(b, at) <= val : get(b, at) >= val; --at) {}
+            unsigned swapped = end - size(b) + at;
+            set(pivot, get(b, at));
+            set(swapped, val);
+        }
+        std::reverse(_blocks.begin() + from, _blocks.begin() + j);
+        for (size_t k = from; k < j; ++k)
+            applyReverse(_blocks[k]);
+        if (from != i) {
+            size_t blocks = _blocks.size();
+            join(from);
+            j -= blocks - _blocks.size();
+        }
+    }
+
+    void runOne(const Op& op, std::vector<Val>& res) {
+        switch (op.type) {
+            case SUM:
+                res.push_back(sum(op.l, op.r));
                 break;
-            case 2:
-                std::cin >> x >> pos;
-                tree.insert(x, pos);
+            case INSERT:
+                insert(op.x, op.l);
                 break;
-            case 3:
-                std::cin >> pos;
-                tree.erase(pos);
+            case ERASE:
+                erase(op.l);
                 break;
-            case 4:
-                std::cin >> x >> l >> r;
-                tree.assign(l, r, x);
+            case ASSIGN:
+                assign(op.l, op.r, op.x);
                 break;
-            case 5:
-                std::cin >> x >> l >> r;
-                tree.add(l, r, x);
+            case ADD:
+                add(op.l, op.r, op.x);
                 break;
-            case 6:
-                std::cin >> l >> r;
-                tree.next_permutation(l, r);
+            case NEXT_PERMUTATION:
+                next_permutation(op.l, op.r);
                 break;
-            case 7:
-                std::cin >> l >> r;
-                tree.prev_permutation(l, r);
+            case PREV_PERMUTATION:
+                prev_permutation(op.l, op.r);
                 break;
             default:
                 throw std::runtime_error("Invalid command");
         }
     }
-    CNode<long long>::inorder(tree.root());
-    std::cout << std::endl;
+public:
+    BlockSequence() : _size(0) {}
+
+    BlockSequence(const Val* begin, const Val* end) : _size(0) {
+        insert(begin, end);
+    }
+
+    void insert(Val val, unsigned pos = unsigned(-1)) {
+        if (_blocks.empty()) {
+            insert(&val, &val + 1);
+            return;
+        }
+        if (pos > _size)
+            pos = _size;
+        size_t k = locate(pos);
+        Block &b = _blocks[k];
+        push(b);
+        b.vals.insert(b.vals.begin() + pos, val);
+        ++_size;
+        if (size(b) > 2 * BLOCK) {
+            Block right = makeBlock(b.vals.data() + BLOCK, b.vals.data() + b.vals.size());
+            b.vals.resize(BLOCK);
+            _blocks.insert(_blocks.begin() + k + 1, std::move(right));
+        }
+        recalc(_blocks[k]);
+    }
+
+    void insert(const Val* begin, const Val* end, unsigned pos = unsigned(-1)) {
+        if (begin == end)
+            return;
+        if (pos > _size)
+            pos = _size;
+        size_t k = cut(pos), first = k;
+        for (; begin != end; begin += std::min<size_t>(end - begin, BLOCK), ++k) {
+            _blocks.insert(_blocks.begin() + k, makeBlock(begin, begin + std::min<size_t>(end - begin, BLOCK)));
+            _size += size(_blocks[k]);
+        }
+        join(k);
+        join(first);
+    }
+
+    void erase(unsigned pos) {
+        if (pos >= _size)
+            throw std::out_of_range("While calling erase");
+        size_t k = locate(pos);
+        Block &b = _blocks[k];
+        push(b);
+        b.vals.erase(b.vals.begin() + pos);
+        --_size;
+        if (b.vals.empty())
+            _blocks.erase(_blocks.begin() + k);
+        else {
+            recalc(b);
+            join(k + 1);
+        }
+        join(k);
+    }
+
+    unsigned size() {
+        return _size;
+    }
+
+    void add(unsigned l, unsigned r, Val val) {
+        onRange(l, r, [this, val](size_t i, size_t j) {
+            for (size_t k = i; k < j; ++k)
+                applyTag(_blocks[k], Policy::add(val));
+        });
+    }
+
+    void assign(unsigned l, unsigned r, Val val) {
+        onRange(l, r, [this, val](size_t i, size_t j) {
+            for (size_t k = i; k < j; ++k)
+                applyTag(_blocks[k], Policy::assign(val));
+        });
+    }
+
+    void reverse(unsigned l, unsigned r) {
+        onRange(l, r, [this](size_t i, size_t j) {
+            std::reverse(_blocks.begin() + i, _blocks.begin() + j);
+            for (size_t k = i; k < j; ++k)
+                applyReverse(_blocks[k]);
+        });
+    }
+
+    // whole blocks give their sums, the two at the ends are scanned
+    Val sum(unsigned l, unsigned r) const {
+        if (r >= _size)
+            r = _size - 1;
+        if (l > r || l >= _size)
+            return Val();
+        unsigned count = r - l + 1;
+        size_t k = locate(l);
+        Val res = Val();
+        for (; count; ++k) {
+            const Block &b = _blocks[k];
+            unsigned n = std::min(count, size(b) - l);
+            if (n == size(b))
+                res += b.sum.sum;
+            else {
+                const Val *v = b.vals.data() + (b.reversed ? size(b) - l - n : l);
+                Val part = blockSum(v, n);
+                if (b.tagged)
+                    part = b.tag.assigned ? b.tag.val * n : part + b.tag.val * n;
+                res += part;
+            }
+            count -= n;
+            l = 0;
+        }
+        return res;
+    }
+
+    void permutation(unsigned l, unsigned r, bool next) {
+        if (l >= _size || r >= _size)
+            throw std::out_of_range("Out of range index while calling next_permutation");
+        onRange(l, r, [this, next](size_t i, size_t& j) {
+            permute(i, j, next);
+        });
+    }
+
+    void next_permutation(unsigned l, unsigned r) {
+        permutation(l, r, true);
+    }
+
+    void prev_permutation(unsigned l, unsigned r) {
+        permutation(l, r, false);
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        for (size_t k = 0; k < _blocks.size(); ++k)
+            for (unsigned i = 0; i < size(_blocks[k]); ++i)
+                f(get(_blocks[k], i));
+    }
+
+    void inorder() const {
+        forEach([](const Val& val) {
+            std::cout << val << " ";
+        });
+    }
+
+    std::vector<Val> run(const std::vector<Op>& ops) {
+        std::vector<Val> res;
+        for (size_t i = 0; i < ops.size(); ++i)
+            runOne(ops[i], res);
+        return res;
+    }
+};
+
+// stdin in large chunks, the tokens are parsed here instead of by streams
+class Reader {
+    FILE *_in;
+    std::vector<char> _buf;
+    size_t _pos, _len;
+
+    bool refill() {
+        if (_pos < _len)
+            return true;
+        _len = fread(_buf.data(), 1, _buf.size(), _in);
+        _pos = 0;
+        return _len > 0;
+    }
+
+    int get() {
+        return refill() ? (unsigned char)_buf[_pos++] : EOF;
+    }
+public:
+    explicit Reader(FILE* in) : _in(in), _buf(1 << 16), _pos(0), _len(0) {}
+
+    // skips the prefix if the input starts with it
+    bool skip(const char* prefix) {
+        size_t n = strlen(prefix);
+        refill();
+        if (_len - _pos < n || memcmp(_buf.data() + _pos, prefix, n))
+            return false;
+        _pos += n;
+        return true;
+    }
+
+    // a decimal integer after whitespace
+    template <typename T>
+    T number() {
+        int c = get();
+        while (c != EOF && isspace(c))
+            c = get();
+        bool negative = c == '-';
+        if (negative)
+            c = get();
+        if (c == EOF || !isdigit(c))
+            throw std::runtime_error("A number expected");
+        T res = 0;
+        for (; c != EOF && isdigit(c); c = get())
+            res = res * 10 + (c - '0');
+        return negative ? -res : res;
+    }
+
+    // a value in the byte order of the machine
+    template <typename T>
+    T raw() {
+        T res;
+        char *to = reinterpret_cast<char*>(&res);
+        for (size_t n = sizeof(T); n;) {
+            if (!refill())
+                throw std::runtime_error("Unexpected end of input");
+            size_t part = std::min(n, _len - _pos);
+            memcpy(to, _buf.data() + _pos, part);
+            _pos += part;
+            to += part;
+            n -= part;
+        }
+        return res;
+    }
+
+    template <typename T>
+    T read(bool binary) {
+        return binary ? raw<T>() : number<T>();
+    }
+};
+
+// output collected in large chunks, flushed by flush() and the destructor
+class Writer {
+    FILE *_out;
+    std::vector<char> _buf;
+
+    void spill() {
+        fwrite(_buf.data(), 1, _buf.size(), _out);
+        _buf.clear();
+    }
+public:
+    static const size_t CHUNK = 1 << 20;
+
+    explicit Writer(FILE* out) : _out(out) {
+        _buf.reserve(CHUNK + 64);
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    ~Writer() {
+        flush();
+    }
+
+    void flush() {
+        spill();
+        fflush(_out);
+    }
+
+    void put(char c) {
+        _buf.push_back(c);
+        if (_buf.size() >= CHUNK)
+            spill();
+    }
+
+    void number(long long x) {
+        char digits[24];
+        int n = 0;
+        unsigned long long u = x < 0 ? 0ull - x : x;
+        do {
+            digits[n++] = '0' + u % 10;
+            u /= 10;
+        } while (u);
+        if (x < 0)
+            put('-');
+        while (n)
+            put(digits[--n]);
+    }
+
+    template <typename T>
+    void raw(T x) {
+        const char *from = reinterpret_cast<const char*>(&x);
+        for (size_t i = 0; i < sizeof(T); ++i)
+            put(from[i]);
+    }
+};
+
+// The binary op stream starts with BINARY_MAGIC and has the fields of the
+// text protocol in the byte order of the machine: n as uint32, n int64
+// values, m as uint32, then every op as its uint8 code and its fields,
+// positions as uint32 and values as int64
+const char BINARY_MAGIC[] = "PERMBIN1";
+
+// the values before the ops, whether the input is binary
+bool readValues(Reader& in, std::vector<long long>& a) {
+    bool binary = in.skip(BINARY_MAGIC);
+    a.resize(in.read<uint32_t>(binary));
+    for (size_t i = 0; i < a.size(); ++i)
+        a[i] = in.read<long long>(binary);
+    return binary;
+}
+
+SequenceOp<long long> readOp(Reader& in, bool binary) {
+    SequenceOp<long long> op;
+    op.type = in.read<uint8_t>(binary);
+    switch (op.type) {
+        case 1:
+        case 6:
+        case 7:
+            op.l = in.read<uint32_t>(binary);
+            op.r = in.read<uint32_t>(binary);
+            break;
+        case 2:
+            op.x = in.read<long long>(binary);
+            op.l = in.read<uint32_t>(binary);
+            break;
+        case 3:
+            op.l = in.read<uint32_t>(binary);
+            break;
+        case 4:
+        case 5:
+            op.x = in.read<long long>(binary);
+            op.l = in.read<uint32_t>(binary);
+            op.r = in.read<uint32_t>(binary);
+            break;
+        default:
+            throw std::runtime_error("Invalid command");
+    }
+    return op;
+}
+
+void readInput(Reader& in, std::vector<long long>& a, std::vector< SequenceOp<long long> >& ops) {
+    bool binary = readValues(in, a);
+    ops.resize(in.read<uint32_t>(binary));
+    for (size_t i = 0; i < ops.size(); ++i)
+        ops[i] = readOp(in, binary);
+}
+
+// the input again as a binary op stream
+void writeBinary(Writer& out, const std::vector<long long>& a, const std::vector< SequenceOp<long long> >& ops) {
+    for (const char *c = BINARY_MAGIC; *c; ++c)
+        out.put(*c);
+    out.raw<uint32_t>(a.size());
+    for (size_t i = 0; i < a.size(); ++i)
+        out.raw<long long>(a[i]);
+    out.raw<uint32_t>(ops.size());
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const SequenceOp<long long> &op = ops[i];
+        out.raw<uint8_t>(op.type);
+        if (op.type == 2 || op.type == 4 || op.type == 5)
+            out.raw<long long>(op.x);
+        out.raw<uint32_t>(op.l);
+        if (op.type != 2 && op.type != 3)
+            out.raw<uint32_t>(op.r);
+    }
+}
+
+// the engine of main(), -DBLOCK_SEQUENCE picks the blocked one
+#ifdef BLOCK_SEQUENCE
+typedef BlockSequence<long long> Sequence;
+#else
+typedef Cartesian<long long> Sequence;
+#endif
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// seconds a fresh Engine takes to run the ops, its sums and final values
+// go to sums and vals
+template <typename Engine>
+double timeRun(const std::vector<long long>& a, const std::vector< SequenceOp<long long> >& ops,
+               std::vector<long long>& sums, std::vector<long long>& vals) {
+    double start = now();
+    Engine seq(a.data(), a.data() + a.size());
+    sums = seq.run(ops);
+    double time = now() - start;
+    vals.clear();
+    seq.forEach([&vals](long long val) {
+        vals.push_back(val);
+    });
+    return time;
+}
+
+// both engines on the same op stream, their results have to agree
+int bench(const std::vector<long long>& a, const std::vector< SequenceOp<long long> >& ops) {
+    std::vector<long long> treapSums, treapVals, blockSums, blockVals;
+    double treap = timeRun< Cartesian<long long> >(a, ops, treapSums, treapVals);
+    double blocks = timeRun< BlockSequence<long long> >(a, ops, blockSums, blockVals);
+    std::cout << "treap  " << treap << " s" << std::endl;
+    std::cout << "blocks " << blocks << " s" << std::endl;
+    if (treapSums != blockSums || treapVals != blockVals) {
+        std::cout << "The engines disagree" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int usage() {
+    std::cerr << "usage: permutation [--bench | --encode] < input" << std::endl;
+    std::cerr << "  the input is the text protocol or its binary form made by --encode" << std::endl;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    bool benchmark = argc == 2 && !strcmp(argv[1], "--bench");
+    bool encode = argc == 2 && !strcmp(argv[1], "--encode");
+    if (argc > 2 || (argc == 2 && !benchmark && !encode))
+        return usage();
+
+    std::vector<long long> a;
+    std::vector<Sequence::Op> ops;
+    Reader in(stdin);
+    if (benchmark || encode) {
+        readInput(in, a, ops);
+        if (benchmark)
+            return bench(a, ops);
+        Writer out(stdout);
+        writeBinary(out, a, ops);
+        return 0;
+    }
+
+    // the ops are read and run BATCH at a time, so the sums of the ops before
+    // a bad one are out before it throws
+    const size_t BATCH = 1 << 16;
+    bool binary = readValues(in, a);
+    size_t m = in.read<uint32_t>(binary);
+    Sequence seq(a.data(), a.data() + a.size());
+    Writer out(stdout);
+    auto runBatch = [&seq, &ops, &out]() {
+        std::vector<long long> sums = seq.run(ops);
+        for (size_t i = 0; i < sums.size(); ++i) {
+            out.number(sums[i]);
+            out.put('\n');
+        }
+        ops.clear();
+    };
+    while (m > 0) {
+        try {
+            while (ops.size() < BATCH && ops.size() < m)
+                ops.push_back(readOp(in, binary));
+        } catch (...) {
+            runBatch();
+            out.flush();
+            throw;
+        }
+        m -= ops.size();
+        runBatch();
+    }
+    seq.forEach([&out](long long val) {
+        out.number(val);
+        out.put(' ');
+    });
+    out.put('\n');
     return 0;
-}
\ No newline at end of file
+}
@@ -1,142 +1,630 @@
 #include <iostream>
 #include <vector>
-#include <complex>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 using std::vector;
 using std::string;
 
+typedef unsigned int limb;
+typedef unsigned long long ull;
 
-vector<int> getDecimalPolyn(string &a);
+
+// pows10[k] = IN_BASE^(2^k), powers of ten for decimal input; the limbs are
+// either owned by pows10Own or live in a table file mapped by loadPows10()
+struct PowSpan {
+    const limb *d;
+    size_t n;
+};
+vector<PowSpan> pows10;
+vector< vector<limb> > pows10Own;
+ull pows10In = 0, pows10Out = 0; // IN_BASE and OUT_BASE the table was built for
+void *pows10Map = nullptr;
+size_t pows10MapSize = 0;
+
+vector<limb> getPolyn(const char *begin, const char *end);
 void getPows10 (int loglog);
-typedef std::complex<double> comp;
-vector< vector<int> > pows10;
-int SHIFT = 4;
-int LASTBITS = (1 << SHIFT) - 1;
+bool loadPows10(const char *path);
+bool savePows10(const char *path);
+
+// input is grouped into limbs of IN_DIGITS digits of IN_RADIX,
+// result limbs hold OUT_DIGITS digits of OUT_RADIX (OUT_BASE < 2^32);
+// for a power of two OUT_RADIX that is SHIFT bits, otherwise SHIFT is 0
+int IN_RADIX = 10;
+int IN_DIGITS = 9;
+limb IN_BASE = 1000000000;
+int OUT_RADIX = 2;
+int OUT_DIGITS = 16;
+ull OUT_BASE = 1 << 16;
+int SHIFT = 16;
+ull LASTBITS = (1ULL << SHIFT) - 1;
+
+// splits an accumulator into the lowest limb and the carry
+inline limb low(ull x) {
+    return SHIFT ? limb(x & LASTBITS) : limb(x % OUT_BASE);
+}
+inline ull high(ull x) {
+    return SHIFT ? x >> SHIFT : x / OUT_BASE;
+}
 
-int GO_TRIVIAL = 4;
+// log2 of a power of two radix, 0 otherwise
+int radixBits(int radix) {
+    int bits = 0;
+    while ((1 << bits) < radix)
+        ++bits;
+    return (1 << bits) == radix ? bits : 0;
+}
 
-vector<int> trivialConversion(vector<int> &a) {
-    vector<int> res;
-    long long num = 0;
-    for (size_t i = 0; i < a.size(); ++i) {
-        num += a[i];
-        num *= 10;
+void setRadices(int inRadix, int outRadix) {
+    IN_RADIX = inRadix;
+    IN_DIGITS = 0;
+    IN_BASE = 1;
+    while (ull(IN_BASE) * inRadix < (1u << 30)) {
+        IN_BASE *= inRadix;
+        ++IN_DIGITS;
     }
-    num /= 10;
-    while (num > 0) {
-        res.insert(res.begin(), num & LASTBITS);
-        num >>= SHIFT;
+    // power of two limbs stay at 16 bits to keep fft pieces wide
+    int bits = radixBits(outRadix);
+    ull limit = bits ? (1ULL << 16) : (1ULL << 31);
+    OUT_RADIX = outRadix;
+    OUT_DIGITS = 0;
+    OUT_BASE = 1;
+    while (OUT_BASE * outRadix <= limit) {
+        OUT_BASE *= outRadix;
+        ++OUT_DIGITS;
     }
-    return res;
+    SHIFT = bits * OUT_DIGITS;
+    LASTBITS = OUT_BASE - 1;
 }
 
-size_t bitRev(int i, size_t n) {
-    int res = 0;
-    while (n > 0) {
-        res += (i & 1);
-        res <<= 1;
-        i >>= 1;
-        n >>= 1;
+// max bits of a convolution coefficient the double fft can still round exactly
+int FFT_PRECISION = 46;
+
+size_t GO_TRIVIAL = 4;
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// seconds spent in every phase of the conversions, collected by --bench;
+// fft time is also a part of the powers table and the recursion
+struct Profile {
+    double parse, pows, recursion, fft, output;
+};
+Profile profile;
+bool profiling = false;
+
+// adds its own lifetime to one of the profile counters
+struct PhaseTimer {
+    double *sum;
+    double start;
+
+    explicit PhaseTimer(double &s) : sum(profiling ? &s : nullptr), start(profiling ? now() : 0) {}
+    ~PhaseTimer() {
+        if (sum)
+            *sum += now() - start;
     }
-    res >>= 2;
-    return res;
+};
+
+// bump allocator for scratch space, released in LIFO order through marks;
+// blocks are kept between conversions so a warmed up arena never allocates
+class Arena {
+    struct Block {
+        char *data;
+        size_t size;
+    };
+    vector<Block> blocks;
+    size_t cur, used;
+public:
+    struct Mark {
+        size_t block, used;
+    };
+
+    Arena() : cur(0), used(0) {}
+    ~Arena() {
+        for (size_t i = 0; i < blocks.size(); ++i)
+            free(blocks[i].data);
+    }
+
+    // makes sure the next `bytes` can be taken from a single block
+    void reserve(size_t bytes) {
+        Mark m = mark();
+        take<char>(bytes);
+        release(m);
+    }
+
+    template <typename T>
+    T* take(size_t n) {
+        size_t bytes = (n * sizeof(T) + 63) & ~size_t(63);
+        if (blocks.empty() || used + bytes > blocks[cur].size) {
+            size_t next = blocks.empty() ? 0 : cur + 1;
+            if (next == blocks.size() || blocks[next].size < bytes) {
+                for (size_t i = next; i < blocks.size(); ++i)
+                    free(blocks[i].data);
+                blocks.resize(next);
+                size_t size = std::max(bytes, blocks.empty() ? size_t(1 << 20) : 2 * blocks.back().size);
+                Block b = {static_cast<char*>(malloc(size)), size};
+                if (!b.data)
+                    throw std::bad_alloc();
+                blocks.push_back(b);
+            }
+            cur = next;
+            used = 0;
+        }
+        T *res = reinterpret_cast<T*>(blocks[cur].data + used);
+        used += bytes;
+        return res;
+    }
+
+    Mark mark() const {
+        Mark m = {cur, used};
+        return m;
+    }
+    void release(const Mark &m) {
+        cur = m.block;
+        used = m.used;
+    }
+};
+
+Arena scratch;
+
+// everything below works on little-endian limb spans (pointer and length),
+// lengths returned by the helpers have no leading (high) zero limbs
+// and zero is the empty span
+
+size_t normLen(const limb *a, size_t n) {
+    while (n && !a[n - 1])
+        --n;
+    return n;
+}
+
+// upper bound on the result limbs for n input limbs, with room for
+// the unnormalized na + nb limbs written by the multiplications
+size_t outLimbs(size_t n) {
+    return size_t(std::ceil(n * std::log2(double(IN_BASE)) / std::log2(double(OUT_BASE)))) + 4;
+}
+
+// in holds n big-endian input limbs
+size_t trivialConversion(const limb *in, size_t n, limb *res) {
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        ull carry = in[i];
+        for (size_t j = 0; j < len; ++j) {
+            ull cur = ull(res[j]) * IN_BASE + carry;
+            res[j] = low(cur);
+            carry = high(cur);
+        }
+        while (carry > 0) {
+            res[len++] = low(carry);
+            carry = high(carry);
+        }
+    }
+    return len;
+}
+
+// the fft works on split real and imaginary arrays (n is a power of two);
+// a butterfly kernel runs one stage: every block of 2h elements is combined
+// with the roots wr[j] + i * sign * wi[j], j < h
+typedef void (*Butterfly)(double *re, double *im, size_t n, size_t h,
+                          const double *wr, const double *wi, double sign);
+
+void butterflyScalar(double *re, double *im, size_t n, size_t h,
+                     const double *wr, const double *wi, double sign) {
+    for (size_t i = 0; i < n; i += 2 * h)
+        for (size_t j = 0; j < h; ++j) {
+            double c = wr[j], d = wi[j] * sign;
+            double xr = re[i + j + h], xi = im[i + j + h];
+            double tr = xr * c - xi * d, ti = xr * d + xi * c;
+            double ar = re[i + j], ai = im[i + j];
+            re[i + j] = ar + tr;
+            im[i + j] = ai + ti;
+            re[i + j + h] = ar - tr;
+            im[i + j + h] = ai - ti;
+        }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2,fma")))
+void butterflyAVX2(double *re, double *im, size_t n, size_t h,
+                   const double *wr, const double *wi, double sign) {
+    __m256d s = _mm256_set1_pd(sign);
+    for (size_t i = 0; i < n; i += 2 * h)
+        for (size_t j = 0; j < h; j += 4) {
+            double *r0 = re + i + j, *i0 = im + i + j, *r1 = r0 + h, *i1 = i0 + h;
+            __m256d c = _mm256_loadu_pd(wr + j), d = _mm256_mul_pd(_mm256_loadu_pd(wi + j), s);
+            __m256d xr = _mm256_loadu_pd(r1), xi = _mm256_loadu_pd(i1);
+            __m256d tr = _mm256_fmsub_pd(xr, c, _mm256_mul_pd(xi, d));
+            __m256d ti = _mm256_fmadd_pd(xr, d, _mm256_mul_pd(xi, c));
+            __m256d ar = _mm256_loadu_pd(r0), ai = _mm256_loadu_pd(i0);
+            _mm256_storeu_pd(r0, _mm256_add_pd(ar, tr));
+            _mm256_storeu_pd(i0, _mm256_add_pd(ai, ti));
+            _mm256_storeu_pd(r1, _mm256_sub_pd(ar, tr));
+            _mm256_storeu_pd(i1, _mm256_sub_pd(ai, ti));
+        }
+}
+
+__attribute__((target("avx512f")))
+void butterflyAVX512(double *re, double *im, size_t n, size_t h,
+                     const double *wr, const double *wi, double sign) {
+    __m512d s = _mm512_set1_pd(sign);
+    for (size_t i = 0; i < n; i += 2 * h)
+        for (size_t j = 0; j < h; j += 8) {
+            double *r0 = re + i + j, *i0 = im + i + j, *r1 = r0 + h, *i1 = i0 + h;
+            __m512d c = _mm512_loadu_pd(wr + j), d = _mm512_mul_pd(_mm512_loadu_pd(wi + j), s);
+            __m512d xr = _mm512_loadu_pd(r1), xi = _mm512_loadu_pd(i1);
+            __m512d tr = _mm512_fmsub_pd(xr, c, _mm512_mul_pd(xi, d));
+            __m512d ti = _mm512_fmadd_pd(xr, d, _mm512_mul_pd(xi, c));
+            __m512d ar = _mm512_loadu_pd(r0), ai = _mm512_loadu_pd(i0);
+            _mm512_storeu_pd(r0, _mm512_add_pd(ar, tr));
+            _mm512_storeu_pd(i0, _mm512_add_pd(ai, ti));
+            _mm512_storeu_pd(r1, _mm512_sub_pd(ar, tr));
+            _mm512_storeu_pd(i1, _mm512_sub_pd(ai, ti));
+        }
 }
-void fft (vector<comp>& a, bool direct) {
-    size_t n = a.size();
-    for (size_t i = 0; i < n; ++i)
-        if (i < bitRev(i, n))
-            std::swap(a[i], a[bitRev(i, n)]);
-    for (size_t l = 2; l <= n; l <<= 1) {
-        double angle = 2*M_PI/l;
-        if (!direct)
-            angle *= -1;
-        comp firstRoot(cos(angle), sin(angle));
-        for (size_t i = 0; i <= n - l; i += l) {
-            comp curRoot(1);
-            comp a0, a1;
-            for (size_t j = 0; j < l / 2; ++j) {
-                a0 = a[i + j], a1 = a[i + j + l / 2] * curRoot;
-                a[i + j] = a0 + a1;
-                a[i + j + l / 2] = a0 - a1;
-                curRoot *= firstRoot;
+#endif
+
+// kernel for the stages with h >= width, narrower stages run the scalar one
+struct FFTKernel {
+    const char *name;
+    Butterfly run;
+    size_t width;
+};
+
+const FFTKernel FFT_KERNELS[] = {
+#if defined(__x86_64__) && defined(__GNUC__)
+    {"avx512", butterflyAVX512, 8},
+    {"avx2", butterflyAVX2, 4},
+#endif
+    {"scalar", butterflyScalar, 1},
+};
+
+bool kernelSupported(const FFTKernel &k) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (!strcmp(k.name, "avx512"))
+        return __builtin_cpu_supports("avx512f");
+    if (!strcmp(k.name, "avx2"))
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return true;
+}
+
+// the widest kernel the cpu runs, unless selectKernel() chose another one
+const FFTKernel* fftKernel() {
+    static const FFTKernel *best = nullptr;
+    if (!best)
+        for (size_t i = 0; !best; ++i)
+            if (kernelSupported(FFT_KERNELS[i]))
+                best = &FFT_KERNELS[i];
+    return best;
+}
+
+const FFTKernel *chosenKernel = nullptr;
+
+bool selectKernel(const char *name) {
+    for (size_t i = 0; i < sizeof(FFT_KERNELS) / sizeof(FFT_KERNELS[0]); ++i)
+        if (!strcmp(FFT_KERNELS[i].name, name) && kernelSupported(FFT_KERNELS[i])) {
+            chosenKernel = &FFT_KERNELS[i];
+            return true;
+        }
+    return false;
+}
+
+// inverse transform is not divided by n, callers fold that into rounding
+void fft (double *re, double *im, size_t n, bool direct) {
+    // roots of stage h are kept at [h, 2h) and computed directly rather than
+    // by repeated multiplication, whose error breaks rounding on long inputs;
+    // bit reversal for smaller n is the one for the table size shifted right
+    static vector<double> rootRe, rootIm;
+    static vector<unsigned> rev;
+    static int logMax = 0;
+    if (rootRe.size() < n) {
+        rootRe.resize(n);
+        rootIm.resize(n);
+        for (size_t h = 1; h < n; h <<= 1)
+            for (size_t j = 0; j < h; ++j) {
+                rootRe[h + j] = cos(M_PI * j / h);
+                rootIm[h + j] = sin(M_PI * j / h);
+            }
+        for (logMax = 0; (size_t(1) << logMax) < n; ++logMax);
+        rev.assign(n, 0);
+        for (size_t i = 1; i < n; ++i)
+            rev[i] = (rev[i >> 1] >> 1) | unsigned((i & 1) << (logMax - 1));
+    }
+    int logn = 0;
+    while ((size_t(1) << logn) < n)
+        ++logn;
+    for (size_t i = 0; i < n; ++i) {
+        size_t j = rev[i] >> (logMax - logn);
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    const FFTKernel *kernel = chosenKernel ? chosenKernel : fftKernel();
+    double sign = direct ? 1 : -1;
+    for (size_t h = 1; h < n; h <<= 1) {
+        Butterfly run = h >= kernel->width ? kernel->run : butterflyScalar;
+        run(re, im, n, h, &rootRe[h], &rootIm[h], sign);
+    }
+}
+
+// for the fft every limb is split into `per` pieces of base `base`,
+// bits is log2(base) when the base is a power of two and 0 otherwise
+struct Pieces {
+    ull base;
+    int per;
+    int bits;
+};
+
+// widest pieces such that the product of two numbers of `limbs` limbs in total
+// fits into FFT_PRECISION bits per coefficient
+Pieces choosePieces(size_t limbs) {
+    ull radix = SHIFT ? 2 : OUT_RADIX;
+    int digits = SHIFT ? SHIFT : OUT_DIGITS;
+    Pieces p;
+    for (int d = digits; d >= 1; --d) {
+        if (digits % d)
+            continue;
+        p.per = digits / d;
+        p.bits = SHIFT ? d : 0;
+        p.base = 1;
+        for (int k = 0; k < d; ++k)
+            p.base *= radix;
+        if (2 * std::log2(double(p.base)) + std::log2(double(limbs * p.per)) <= FFT_PRECISION)
+            break;
+    }
+    return p;
+}
+
+void toPieces(const limb *a, size_t n, double *f, const Pieces &p) {
+    for (size_t i = 0; i < n; ++i) {
+        ull x = a[i];
+        for (int k = 0; k < p.per; ++k) {
+            if (p.bits) {
+                f[i * p.per + k] = double(x & (p.base - 1));
+                x >>= p.bits;
+            } else {
+                f[i * p.per + k] = double(x % p.base);
+                x /= p.base;
             }
         }
     }
-    if (!direct)
-        for (size_t i = 0; i < n; ++i)
-            a[i] /= n;
 }
 
-void multy(vector<int> &a, vector<int> &b) {
+// res += x * OUT_BASE^shift, res must be long enough to hold the sum
+void addShifted(limb *res, const limb *x, size_t nx, size_t shift) {
+    ull carry = 0;
+    size_t i = 0;
+    for (; i < nx; ++i) {
+        carry += ull(res[i + shift]) + x[i];
+        res[i + shift] = low(carry);
+        carry = high(carry);
+    }
+    for (; carry; ++i) {
+        carry += res[i + shift];
+        res[i + shift] = low(carry);
+        carry = high(carry);
+    }
+}
+
+// res = a + b, res has room for max(na, nb) + 1 limbs and may be a or b
+size_t addSpan(const limb *a, size_t na, const limb *b, size_t nb, limb *res) {
+    if (na < nb) {
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+    ull carry = 0;
+    for (size_t i = 0; i < na; ++i) {
+        carry += ull(a[i]) + (i < nb ? b[i] : 0);
+        res[i] = low(carry);
+        carry = high(carry);
+    }
+    res[na] = limb(carry);
+    return normLen(res, na + 1);
+}
+
+// res = a - b, requires a >= b, res may be a or b
+size_t subSpan(const limb *a, size_t na, const limb *b, size_t nb, limb *res) {
+    long long borrow = 0;
+    for (size_t i = 0; i < na; ++i) {
+        long long cur = (long long)a[i] - (i < nb ? b[i] : 0) - borrow;
+        borrow = cur < 0;
+        res[i] = limb(cur + borrow * (long long)OUT_BASE);
+    }
+    return normLen(res, na);
+}
+
+// operand sizes (in limbs) at which a faster algorithm takes over,
+// defaults are overwritten by calibrate()
+size_t KARATSUBA_THRESHOLD = 24;
+size_t FFT_THRESHOLD = 48;
+
+// every multiplication writes all na + nb limbs of res, which must not
+// overlap the operands, and returns the normalized length
+typedef size_t (*MulFn)(const limb*, size_t, const limb*, size_t, limb*);
+
+size_t mulDispatch(const limb *a, size_t na, const limb *b, size_t nb, limb *res);
+
+size_t mulSchool(const limb *a, size_t na, const limb *b, size_t nb, limb *res) {
+    std::fill(res, res + na + nb, 0);
+    for (size_t i = 0; i < na; ++i) {
+        ull carry = 0;
+        for (size_t j = 0; j < nb; ++j) {
+            carry += res[i + j] + ull(a[i]) * b[j];
+            res[i + j] = low(carry);
+            carry = high(carry);
+        }
+        res[i + nb] = limb(carry);
+    }
+    return normLen(res, na + nb);
+}
+
+size_t mulKaratsuba(const limb *a, size_t na, const limb *b, size_t nb, limb *res) {
+    size_t half = (std::max(na, nb) + 1) / 2;
+    size_t na0 = normLen(a, std::min(na, half)), na1 = na > half ? na - half : 0;
+    size_t nb0 = normLen(b, std::min(nb, half)), nb1 = nb > half ? nb - half : 0;
+    Arena::Mark m = scratch.mark();
+    limb *sa = scratch.take<limb>(half + 1), *sb = scratch.take<limb>(half + 1);
+    size_t nsa = addSpan(a, na0, a + half, na1, sa);
+    size_t nsb = addSpan(b, nb0, b + half, nb1, sb);
+    limb *z1 = scratch.take<limb>(nsa + nsb);
+    size_t nz1 = mulDispatch(sa, nsa, sb, nsb, z1);
+
+    std::fill(res, res + na + nb, 0);
+    size_t nz0 = mulDispatch(a, na0, b, nb0, res);
+    size_t nz2 = na1 && nb1 ? mulDispatch(a + half, na1, b + half, nb1, res + 2 * half) : 0;
+    nz1 = subSpan(z1, nz1, res, nz0, z1);
+    nz1 = subSpan(z1, nz1, res + 2 * half, nz2, z1);
+    addShifted(res, z1, nz1, half);
+    scratch.release(m);
+    return normLen(res, na + nb);
+}
+
+size_t mulFFT(const limb *a, size_t na, const limb *b, size_t nb, limb *res) {
+    size_t len = na + nb;
+    std::fill(res, res + len, 0);
+    if (!na || !nb)
+        return 0;
+    PhaseTimer timer(profile.fft);
+    bool square = (a == b && na == nb);
+    Pieces p = choosePieces(len);
     size_t sz = 1;
-    while (sz < std::max(a.size(), b.size()))
+    while (sz < p.per * len)
         sz <<= 1;
-    sz <<= 1;
-    vector<comp> fa(sz - a.size(), 0), fb(sz - b.size(), 0);
-    for (size_t i = 0; i < a.size(); ++i)
-        fa.push_back(a[i]);
-    for (size_t i = 0; i < b.size(); ++i)
-        fb.push_back(b[i]);
-    fft(fa, true);
-    fft(fb, true);
-    for (size_t i = 0; i < sz; ++i)
-        fa[i] *= fb[i];
-    fft(fa, false);
-    a.resize(sz);
-    for (size_t i = 0; i < sz; ++i)
-        a[i] = int(fa[i].real() + 0.5);
-    for (int i = sz - 1; i > 0; --i)
-        if (a[i] > LASTBITS) {
-            a[i - 1] += (a[i] >> SHIFT);
-            a[i] &= LASTBITS;
-        }
-    a.pop_back();
-    a.insert(a.begin(), 0);
-    if (a[1] > LASTBITS) {
-        a[0] += (a[1] >> SHIFT);
-        a[1] &= LASTBITS;
-    }
-    int del = -1;
-    while (del < int(a.size()) && !a[++del]);
-    if (del > 0)
-        a.erase(a.begin(), a.begin() + del);
-}
-
-void recurse(vector<int> &a, int log) {
-    if (a.size() <= GO_TRIVIAL) {
-        a = trivialConversion(a);
-        return;
+    Arena::Mark m = scratch.mark();
+    double *re = scratch.take<double>(sz), *im = scratch.take<double>(sz);
+    std::fill(re, re + sz, 0.0);
+    std::fill(im, im + sz, 0.0);
+    // both real operands go into one transform, a as the real part and b as
+    // the imaginary one, and are separated through Z[k] and conj(Z[n - k])
+    toPieces(a, na, re, p);
+    if (!square)
+        toPieces(b, nb, im, p);
+    fft(re, im, sz, true);
+    for (size_t k = 0; k <= sz / 2; ++k) {
+        size_t nk = (sz - k) & (sz - 1);
+        double zr = re[k], zi = im[k], wr = re[nk], wi = im[nk];
+        double cr, ci;
+        if (square) {
+            cr = zr * zr - zi * zi;
+            ci = 2 * zr * zi;
+            re[nk] = wr * wr - wi * wi;
+            im[nk] = 2 * wr * wi;
+        } else {
+            double ar = (zr + wr) / 2, ai = (zi - wi) / 2;
+            double br = (zi + wi) / 2, bi = (wr - zr) / 2;
+            cr = ar * br - ai * bi;
+            ci = ar * bi + ai * br;
+            re[nk] = cr;
+            im[nk] = -ci;
+        }
+        re[k] = cr;
+        im[k] = ci;
     }
-    size_t hsz = (a.size() & ((1 << log)  - 1));
+    fft(re, im, sz, false);
+    double scale = 1.0 / sz;
+    ull carry = 0, weight = 1;
+    for (size_t i = 0; i < len * p.per; ++i) {
+        carry += ull(re[i] * scale + 0.5);
+        if (i % p.per == 0)
+            weight = 1;
+        if (p.bits) {
+            res[i / p.per] |= limb((carry & (p.base - 1)) << (i % p.per * p.bits));
+            carry >>= p.bits;
+        } else {
+            res[i / p.per] += limb(carry % p.base * weight);
+            carry /= p.base;
+            weight *= p.base;
+        }
+    }
+    scratch.release(m);
+    return normLen(res, len);
+}
+
+size_t mulDispatch(const limb *a, size_t na, const limb *b, size_t nb, limb *res) {
+    size_t n = std::max(na, nb);
+    if (std::min(na, nb) < KARATSUBA_THRESHOLD)
+        return mulSchool(a, na, b, nb, res);
+    if (n >= FFT_THRESHOLD)
+        return mulFFT(a, na, b, nb, res);
+    return mulKaratsuba(a, na, b, nb, res);
+}
+
+double timeMul(MulFn mul, size_t n) {
+    vector<limb> a(n), b(n), res(2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = limb(rand() % OUT_BASE);
+        b[i] = limb(rand() % OUT_BASE);
+    }
+    a[n - 1] = b[n - 1] = 1;
+    int reps = 0;
+    double start = now(), elapsed;
+    do {
+        mul(a.data(), n, b.data(), n, res.data());
+        ++reps;
+        elapsed = now() - start;
+    } while (elapsed < 0.02);
+    return elapsed / reps;
+}
+
+// first size from which faster() beats slower(), every other threshold
+// is expected to be set so that subproducts use the already tuned algorithms
+size_t crossover(MulFn slower, MulFn faster, size_t from, size_t to) {
+    for (size_t n = from; n < to; n += (n + 3) / 4)
+        if (timeMul(faster, n) < timeMul(slower, n))
+            return n;
+    return to;
+}
+
+// benchmarks the algorithms against each other and sets the thresholds
+void calibrate() {
+    const size_t NEVER = size_t(-1);
+    KARATSUBA_THRESHOLD = FFT_THRESHOLD = NEVER;
+    KARATSUBA_THRESHOLD = crossover(mulSchool, mulKaratsuba, 4, 1024);
+    FFT_THRESHOLD = crossover(mulDispatch, mulFFT, KARATSUBA_THRESHOLD, 1 << 16);
+}
+
+// converts n big-endian input limbs into res (room for outLimbs(n) limbs),
+// the halves are converted into scratch and combined in place in res
+size_t recurse(const limb *in, size_t n, int log, limb *res) {
+    if (n <= GO_TRIVIAL)
+        return trivialConversion(in, n, res);
+    size_t hsz = (n & ((size_t(1) << log) - 1));
     if (!hsz)
-        hsz = a.size() / 2;
-    vector<int> first(a.begin(), a.begin() + hsz);
-    vector<int> second(a.begin() + hsz, a.end());
-    int logfirst = 0, fsz = 1;
-    while (fsz < first.size()) {
+        hsz = n / 2;
+    int logfirst = 0;
+    size_t fsz = 1;
+    while (fsz < hsz) {
         fsz <<= 1;
         ++logfirst;
     }
-    recurse(first, logfirst - 1);
-    recurse(second, log - 1);
-    a.clear();
-    if (!first.size()) {
-        a = second;
-        return;
-    }
-    multy(first, pows10[log]);
-    a.resize(first.size(), 0);
-    second.insert(second.begin(), first.size() - second.size(), 0);
-    for (int i = a.size() - 1; i > 0; --i) {
-        a[i] += first[i] + second[i];
-        a[i - 1] += (a[i] >> SHIFT);
-        a[i] &= LASTBITS;
-    }
-    a[0] += first[0] + second[0];
-    if (a[0] > LASTBITS) {
-        a.insert(a.begin(), 0);
-        a[0] = (a[1] >> SHIFT);
-        a[1] &= LASTBITS;
+    Arena::Mark m = scratch.mark();
+    limb *first = scratch.take<limb>(outLimbs(hsz));
+    size_t len1 = recurse(in, hsz, logfirst - 1, first);
+    if (!len1) {
+        scratch.release(m);
+        return recurse(in + hsz, n - hsz, log - 1, res);
     }
+    limb *second = scratch.take<limb>(outLimbs(n - hsz));
+    size_t len2 = recurse(in + hsz, n - hsz, log - 1, second);
+    const PowSpan &pow = pows10[log];
+    size_t len = mulDispatch(first, len1, pow.d, pow.n, res);
+    res[len] = 0;
+    addShifted(res, second, len2, 0);
+    scratch.release(m);
+    return normLen(res, len + 1);
 }
 
 string ntos(int n) {
@@ -148,59 +636,485 @@ string ntos(int n) {
     return s;
 }
 
+const char DIGITS[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+// n random digits of IN_RADIX
 string getTest(int n) {
     string res;
-    for (int i = 0; i < n; ++i) {
-        int k = rand() % 10;
-        res.push_back('0' + k);
+    for (int i = 0; i < n; ++i)
+        res.push_back(DIGITS[rand() % IN_RADIX]);
+    return res;
+}
+
+int digitValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 10;
+    return 36;
+}
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// whole input either mapped into memory or, for pipes, read in big chunks
+struct Input {
+    const char *data;
+    size_t size;
+    void *mapped;
+    vector<char> copy;
+
+    Input() : data(nullptr), size(0), mapped(nullptr) {}
+    ~Input() {
+        if (mapped)
+            munmap(mapped, size);
+    }
+
+    void open(int fd) {
+        struct stat st;
+        if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size = size_t(st.st_size);
+            mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(mapped);
+                return;
+            }
+            mapped = nullptr;
+        }
+        const size_t CHUNK = 1 << 24;
+        size = 0;
+        for (ssize_t got = 1; got > 0; size += size_t(got)) {
+            copy.resize(size + CHUNK);
+            got = read(fd, copy.data() + size, CHUNK);
+            if (got < 0)
+                throw std::runtime_error("Can't read input");
+        }
+        data = copy.data();
+    }
+};
+
+struct Output {
+    FILE *file;
+    vector<char> buf;
+    size_t used;
+
+    explicit Output(FILE *f) : file(f), buf(1 << 20), used(0) {}
+    ~Output() {
+        flush();
+    }
+
+    void put(char c) {
+        if (used == buf.size())
+            flush();
+        buf[used++] = c;
+    }
+    void flush() {
+        fwrite(buf.data(), 1, used, file);
+        used = 0;
+    }
+};
+
+// every limb but the highest one is printed with all OUT_DIGITS digits
+void writeText(const vector<limb> &a, Output &out) {
+    if (a.empty()) {
+        out.put('0');
+        return;
+    }
+    char digits[64];
+    int bits = radixBits(OUT_RADIX);
+    for (size_t i = a.size(); i-- > 0;) {
+        limb x = a[i];
+        int len = 0;
+        for (; len < OUT_DIGITS && (i + 1 < a.size() || x); ++len) {
+            digits[len] = DIGITS[bits ? x & (OUT_RADIX - 1) : x % OUT_RADIX];
+            x = bits ? x >> bits : x / OUT_RADIX;
+        }
+        while (len > 0)
+            out.put(digits[--len]);
+    }
+}
+
+// a is binary, written as big-endian bytes
+void writePacked(const vector<limb> &a, Output &out) {
+    if (a.empty()) {
+        out.put(0);
+        return;
+    }
+    int top = 0;
+    while (top < SHIFT && (a.back() >> top))
+        ++top;
+    ull acc = a.back();
+    int accBits = top + (8 - (top + (a.size() - 1) * SHIFT) % 8) % 8;
+    for (size_t i = a.size(); i-- > 0;) {
+        if (i + 1 < a.size()) {
+            acc = (acc << SHIFT) | a[i];
+            accBits += SHIFT;
+        }
+        for (; accBits >= 8; accBits -= 8)
+            out.put(char((acc >> (accBits - 8)) & 255));
+    }
+}
+
+// power of two radices on both sides only need the bits regrouped
+vector<limb> repackBits(const char *begin, const char *end) {
+    int inBits = radixBits(IN_RADIX);
+    vector<limb> res;
+    ull acc = 0;
+    int accBits = 0;
+    for (const char *c = end; c-- != begin;) {
+        if (isSpace(*c))
+            continue;
+        int d = digitValue(*c);
+        if (d >= IN_RADIX)
+            throw std::invalid_argument("Invalid digit in input");
+        acc |= ull(d) << accBits;
+        accBits += inBits;
+        while (accBits >= SHIFT) {
+            res.push_back(limb(acc & LASTBITS));
+            acc >>= SHIFT;
+            accBits -= SHIFT;
+        }
     }
+    res.push_back(limb(acc));
+    res.resize(normLen(res.data(), res.size()));
     return res;
 }
 
-int main() {
-    string s;
-    std::cin >> s;
-    if (s == "0") {
-        printf("0");
-        return 0;
+vector<limb> convert(const char *begin, const char *end) {
+    vector<limb> a;
+    {
+        PhaseTimer timer(profile.parse);
+        if (radixBits(IN_RADIX) && SHIFT)
+            return repackBits(begin, end);
+        a = getPolyn(begin, end);
     }
+    if (a.empty())
+        return a;
     size_t sz = 1;
     int log = 0;
-    while (sz < s.size()) {
+    while (sz < a.size()) {
         sz <<= 1;
         ++log;
     }
-    vector<int> a = getDecimalPolyn(s);
-    getPows10(log + 1);
-    recurse(a, log - 1);
-    vector<int> res;
-    for (int i = 0; i < a.size(); ++i) {
-        for (int j = SHIFT - 1; j >= 0; --j)
-            res.push_back((a[i] >> j) & 1);
-    }
-    int i = -1;
-    while (!res[++i]);
-    for (; i < res.size(); ++i)
-        printf("%d", res[i]);
+    {
+        PhaseTimer timer(profile.pows);
+        getPows10(log + 1);
+    }
+    PhaseTimer timer(profile.recursion);
+    vector<limb> res(outLimbs(a.size()));
+    // two halves of the result plus the fft buffers of the top product
+    scratch.reserve(res.size() * (2 * sizeof(limb) + 4 * sizeof(double)));
+    res.resize(recurse(a.data(), a.size(), log - 1, res.data()));
+    return res;
+}
+
+// quadratic digit by digit conversion, the oracle for convert()
+vector<limb> referenceConvert(const string &s) {
+    vector<limb> res;
+    for (size_t i = 0; i < s.size(); ++i) {
+        ull carry = digitValue(s[i]);
+        for (size_t j = 0; j < res.size(); ++j) {
+            carry += ull(res[j]) * IN_RADIX;
+            res[j] = low(carry);
+            carry = high(carry);
+        }
+        for (; carry; carry = high(carry))
+            res.push_back(low(carry));
+    }
+    return res;
+}
+
+// checks convert() against the oracle for every radix pair on small inputs,
+// returns the number of mismatches
+int selfCheck() {
+    int inRadix = IN_RADIX, outRadix = OUT_RADIX, failed = 0;
+    const int RADICES[] = {2, 3, 8, 10, 16, 36};
+    for (int from : RADICES)
+        for (int to : RADICES) {
+            setRadices(from, to);
+            for (int n = 1; n <= 3000; n += n < 64 ? 1 : n / 3) {
+                string s = getTest(n);
+                if (convert(s.data(), s.data() + s.size()) != referenceConvert(s)) {
+                    fprintf(stderr, "mismatch: %d digits from radix %d to %d\n", n, from, to);
+                    ++failed;
+                }
+            }
+        }
+    setRadices(inRadix, outRadix);
+    return failed;
+}
+
+// times the conversion phases for 1e3..maxDigits random digits, the average
+// over enough repetitions to take about a second is printed per conversion
+void bench(size_t maxDigits) {
+    FILE *sink = fopen("/dev/null", "wb");
+    if (!sink)
+        throw std::runtime_error("Can't open /dev/null");
+    printf("%10s %10s %10s %10s %10s %10s %10s  %s\n",
+           "digits", "parse", "pows", "recursion", "fft", "output", "total", "check");
+    profiling = true;
+    for (size_t n = 1000; n <= maxDigits; n *= 10) {
+        string s = getTest(int(n));
+        const char *check = "-";
+        if (n <= 10000)
+            check = convert(s.data(), s.data() + s.size()) == referenceConvert(s) ? "ok" : "FAIL";
+        profile = Profile();
+        Output out(sink);
+        int reps = 0;
+        double start = now(), elapsed;
+        do {
+            // the powers table is rebuilt each time to be a part of the timing
+            pows10In = 0;
+            vector<limb> a = convert(s.data(), s.data() + s.size());
+            PhaseTimer timer(profile.output);
+            writeText(a, out);
+            out.flush();
+            ++reps;
+            elapsed = now() - start;
+        } while (elapsed < 1);
+        printf("%10zu %10.6f %10.6f %10.6f %10.6f %10.6f %10.6f  %s\n", n,
+               profile.parse / reps, profile.pows / reps, profile.recursion / reps,
+               profile.fft / reps, profile.output / reps, elapsed / reps, check);
+        fflush(stdout);
+    }
+    profiling = false;
+    fclose(sink);
+}
+
+int usage() {
+    fprintf(stderr, "usage: radix [--from R] [--to R] [--packed] [--lines] [--pows FILE]"
+                    " [--kernel scalar|avx2|avx512] [--calibrate] [--bench [DIGITS]] [input [output]]\n"
+                    "  converts a number from radix --from (default 10) to radix --to (default 2),\n"
+                    "  radices are 2..36, --packed writes big-endian bytes instead of digits,\n"
+                    "  --lines converts every input line as a separate number,\n"
+                    "  --pows keeps the table of powers of the input radix in FILE between runs,\n"
+                    "  --kernel overrides the fft kernel picked for the cpu,\n"
+                    "  --bench checks small conversions against a quadratic oracle and\n"
+                    "  times every phase for 1e3 up to DIGITS (default 1e7) digits\n");
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int from = 10, to = 2;
+    bool packed = false, calibration = false, lines = false;
+    size_t benchDigits = 0;
+    const char *inPath = nullptr, *outPath = nullptr, *powsPath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--calibrate"))
+            calibration = true;
+        else if (!strcmp(argv[i], "--bench")) {
+            benchDigits = 10000000;
+            if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                benchDigits = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--packed"))
+            packed = true;
+        else if (!strcmp(argv[i], "--lines"))
+            lines = true;
+        else if (!strcmp(argv[i], "--pows") && i + 1 < argc)
+            powsPath = argv[++i];
+        else if (!strcmp(argv[i], "--kernel") && i + 1 < argc) {
+            if (!selectKernel(argv[++i])) {
+                fprintf(stderr, "Kernel %s is not available\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--from") && i + 1 < argc)
+            from = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--to") && i + 1 < argc)
+            to = atoi(argv[++i]);
+        else if (!inPath)
+            inPath = argv[i];
+        else if (!outPath)
+            outPath = argv[i];
+        else
+            return usage();
+    }
+    if (from < 2 || from > 36 || to < 2 || to > 36 || (lines && packed))
+        return usage();
+    setRadices(from, packed ? 2 : to);
+    if (calibration) {
+        calibrate();
+        printf("KARATSUBA_THRESHOLD = %zu\nFFT_THRESHOLD = %zu\n", KARATSUBA_THRESHOLD, FFT_THRESHOLD);
+        return 0;
+    }
+    if (benchDigits) {
+        if (packed)
+            return usage();
+        int failed = selfCheck();
+        printf("self check: %d mismatches\n", failed);
+        bench(benchDigits);
+        return failed ? 1 : 0;
+    }
+
+    int fd = inPath ? ::open(inPath, O_RDONLY) : 0;
+    FILE *file = outPath ? fopen(outPath, "wb") : stdout;
+    if (fd < 0 || !file) {
+        fprintf(stderr, "Can't open %s\n", fd < 0 ? inPath : outPath);
+        return 1;
+    }
+    try {
+        Input in;
+        in.open(fd);
+        size_t levels = powsPath && loadPows10(powsPath) ? pows10.size() : 0;
+        Output out(file);
+        const char *end = in.data + in.size;
+        for (const char *begin = in.data; ; ) {
+            const char *next = lines ? std::find(begin, end, '\n') : end;
+            bool blank = lines && std::find_if(begin, next, [](char c) { return !isSpace(c); }) == next;
+            if (!blank) {
+                vector<limb> a = convert(begin, next);
+                if (packed)
+                    writePacked(a, out);
+                else
+                    writeText(a, out);
+                if (lines)
+                    out.put('\n');
+            }
+            if (next == end)
+                break;
+            begin = next + 1;
+        }
+        if (powsPath && pows10.size() > levels && !savePows10(powsPath))
+            fprintf(stderr, "Can't save %s\n", powsPath);
+    } catch (std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    if (inPath)
+        close(fd);
+    if (file != stdout)
+        fclose(file);
     return 0;
 }
 
-vector<int> getDecimalPolyn(string &a) {
-    vector<int> res;
-    for (int i = 0; i < a.size(); ++i)
-        res.push_back(a[i] - '0');
+// big-endian limbs of IN_DIGITS digits, leading zeros and whitespace are skipped
+vector<limb> getPolyn(const char *begin, const char *end) {
+    size_t count = 0;
+    for (const char *c = begin; c != end; ++c) {
+        if (isSpace(*c))
+            continue;
+        int d = digitValue(*c);
+        if (d >= IN_RADIX)
+            throw std::invalid_argument("Invalid digit in input");
+        if (d || count)
+            ++count;
+    }
+    vector<limb> res((count + IN_DIGITS - 1) / IN_DIGITS, 0);
+    size_t head = count % IN_DIGITS;
+    if (!head)
+        head = IN_DIGITS;
+    size_t pos = 0;
+    for (const char *c = begin; c != end; ++c) {
+        if (isSpace(*c))
+            continue;
+        int d = digitValue(*c);
+        if (!d && !pos)
+            continue;
+        size_t i = pos < head ? 0 : (pos - head) / IN_DIGITS + 1;
+        res[i] = res[i] * IN_RADIX + d;
+        ++pos;
+    }
     return res;
 }
 
+// extends the table up to level loglog - 2, levels computed by earlier
+// conversions (or loaded from a file) are reused
 void getPows10 (int loglog) {
-    vector<int> cur(2);
-    cur[0] = 1, cur[1] = 0;
-    cur = trivialConversion(cur);
+    if (pows10In != IN_BASE || pows10Out != OUT_BASE) {
+        pows10.clear();
+        pows10Own.clear();
+        pows10In = IN_BASE;
+        pows10Out = OUT_BASE;
+    }
+    if (pows10.empty()) {
+        limb ten[2] = {1, 0};
+        vector<limb> cur(outLimbs(2));
+        cur.resize(trivialConversion(ten, 2, cur.data()));
+        pows10Own.push_back(cur);
+        PowSpan p = {pows10Own.back().data(), cur.size()};
+        pows10.push_back(p);
+    }
+    while (int(pows10.size()) < loglog - 1) {
+        const PowSpan &cur = pows10.back();
+        vector<limb> next(2 * cur.n);
+        next.resize(mulDispatch(cur.d, cur.n, cur.d, cur.n, next.data()));
+        pows10Own.push_back(next);
+        PowSpan p = {pows10Own.back().data(), next.size()};
+        pows10.push_back(p);
+    }
+}
+
+// table file: "RDXPOW01", IN_BASE, OUT_BASE, number of levels and the length
+// of every level as 64-bit words, followed by the limbs of all levels
+const char POWS_MAGIC[8] = {'R', 'D', 'X', 'P', 'O', 'W', '0', '1'};
+
+// maps a table written by savePows10() for the current radices
+bool loadPows10(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    if (!fstat(fd, &st) && st.st_size >= 32) {
+        size = size_t(st.st_size);
+        map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    const ull *head = static_cast<const ull*>(map);
+    ull levels = head[3];
+    bool ok = !memcmp(head, POWS_MAGIC, 8) && head[1] == IN_BASE && head[2] == OUT_BASE
+              && levels > 0 && levels < 64 && (4 + levels) * 8 <= size;
+    size_t total = 0;
+    for (ull i = 0; ok && i < levels; ++i)
+        total += head[4 + i];
+    if (!ok || (4 + levels) * 8 + total * sizeof(limb) != size) {
+        munmap(map, size);
+        return false;
+    }
+    if (pows10Map)
+        munmap(pows10Map, pows10MapSize);
+    pows10Map = map;
+    pows10MapSize = size;
     pows10.clear();
-    pows10.push_back(cur);
-    for (int i = 1; i < loglog - 1; ++i) {
-        cur.insert(cur.begin(), cur.size(), 0);
-        multy(cur, cur);
-        pows10.push_back(cur);
+    pows10Own.clear();
+    pows10In = IN_BASE;
+    pows10Out = OUT_BASE;
+    const limb *d = reinterpret_cast<const limb*>(head + 4 + levels);
+    for (ull i = 0; i < levels; ++i) {
+        PowSpan p = {d, size_t(head[4 + i])};
+        pows10.push_back(p);
+        d += p.n;
     }
+    return true;
+}
+
+// written to a temporary file and renamed, so a mapped table stays valid
+bool savePows10(const char *path) {
+    string tmp = string(path) + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (!file)
+        return false;
+    vector<ull> head(4 + pows10.size());
+    memcpy(&head[0], POWS_MAGIC, 8);
+    head[1] = IN_BASE;
+    head[2] = OUT_BASE;
+    head[3] = pows10.size();
+    for (size_t i = 0; i < pows10.size(); ++i)
+        head[4 + i] = pows10[i].n;
+    bool ok = fwrite(head.data(), sizeof(ull), head.size(), file) == head.size();
+    for (size_t i = 0; ok && i < pows10.size(); ++i)
+        ok = fwrite(pows10[i].d, sizeof(limb), pows10[i].n, file) == pows10[i].n;
+    ok = !fclose(file) && ok;
+    if (ok && !rename(tmp.c_str(), path))
+        return true;
+    remove(tmp.c_str());
+    return false;
 }